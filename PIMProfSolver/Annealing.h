@@ -0,0 +1,176 @@
+//===- Annealing.h - Simulated annealing over decisions ---------*- C++ -*-===//
+//
+//
+//===----------------------------------------------------------------------===//
+//
+//
+//===----------------------------------------------------------------------===//
+#ifndef __ANNEALING_H__
+#define __ANNEALING_H__
+
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cassert>
+
+#include "Common.h"
+#include "IncrementalCost.h"
+#include "Checkpoint.h"
+
+namespace PIMProf
+{
+/* ===================================================================== */
+/* AnnealingSchedule */
+/* ===================================================================== */
+/// The temperature decays geometrically from _start to _end over _iterations moves.
+/// Temperatures are in the same unit as COST.
+struct AnnealingSchedule
+{
+    uint64_t _iterations = 100000;
+    double _start = 0;
+    double _end = 0;
+    double _segment_ratio = 0.2; // fraction of moves that reassign a whole reuse segment
+
+    inline double Temperature(uint64_t iteration) const
+    {
+        return _start * std::pow(_end / _start, (double)iteration / _iterations);
+    }
+};
+
+/* ===================================================================== */
+/* AnnealingChain */
+/* ===================================================================== */
+/// One annealing chain over a private IncrementalCost engine.
+/// A move either flips one BBL or moves every member of one reuse segment
+/// to the same site, and is accepted with the Metropolis rule.
+/// The chain is deterministic for a given start decision and seed,
+/// unless it is stopped early by the checkpoint.
+class AnnealingChain
+{
+  public:
+    static const uint64_t RESET_INTERVAL = 1 << 16;
+    static const uint64_t STOP_CHECK_INTERVAL = 1024;
+
+  private:
+    const CostIndex *_index;
+    IncrementalCost _engine;
+    std::mt19937_64 _rng;
+
+    DECISION _best;
+    COST _best_cost;
+    // the current decision is the best one, but has not been copied to _best yet,
+    // it is copied only before the chain moves uphill
+    bool _best_pending = false;
+
+    // scratch for undoing a segment move
+    std::vector<std::pair<BBLID, CostSite>> _undo;
+
+  public:
+    AnnealingChain(const CostIndex *index, const DECISION &start, uint64_t seed)
+        : _index(index), _engine(index, start), _rng(seed),
+          _best(start), _best_cost(_engine.Cost())
+    {}
+
+    /// the best decision is offered to checkpoint every STOP_CHECK_INTERVAL moves
+    void Run(const AnnealingSchedule &schedule, Checkpoint *checkpoint = nullptr)
+    {
+        COST offered_cost = MAX_COST;
+        std::uniform_real_distribution<double> uniform(0, 1);
+        std::uniform_int_distribution<BBLID> pickbbl(0, _index->_size - 1);
+        uint32_t leaves = _index->LeafCount();
+        std::uniform_int_distribution<uint32_t> pickleaf(0, leaves == 0 ? 0 : leaves - 1);
+
+        for (uint64_t it = 0; it < schedule._iterations; ++it) {
+            if (checkpoint != nullptr && it % STOP_CHECK_INTERVAL == 0) {
+                if (_best_cost < offered_cost) {
+                    checkpoint->Offer(_best_pending ? _engine.decision() : _best, _best_cost);
+                    offered_cost = _best_cost;
+                }
+                if (checkpoint->Stopped()) break;
+            }
+            // remove the rounding error accumulated by the incremental updates
+            if (it % RESET_INTERVAL == RESET_INTERVAL - 1) {
+                _engine.Reset(_engine.decision());
+            }
+            double temperature = schedule.Temperature(it);
+            bool segment = (leaves > 0 && uniform(_rng) < schedule._segment_ratio);
+            COST before = _engine.Cost();
+
+            if (segment) {
+                uint32_t leaf = pickleaf(_rng);
+                CostSite site = (uniform(_rng) < 0.5 ? CPU : PIM);
+                _undo.clear();
+                for (uint32_t m = _index->_leaf_begin[leaf]; m < _index->_leaf_begin[leaf + 1]; ++m) {
+                    BBLID bblid = _index->_leaf_member[m];
+                    if (_engine.site(bblid) != site) {
+                        _undo.push_back(std::make_pair(bblid, _engine.site(bblid)));
+                        _engine.Assign(bblid, site);
+                    }
+                }
+                if (_undo.empty()) continue;
+                COST delta = _engine.Cost() - before;
+                if (!Accept(delta, temperature, uniform(_rng))) {
+                    for (auto undo = _undo.rbegin(); undo != _undo.rend(); ++undo) {
+                        _engine.Assign(undo->first, undo->second);
+                    }
+                    continue;
+                }
+                if (delta > 0 && _best_pending) {
+                    // the best decision is the one before this move
+                    SaveBestBeforeSegmentMove();
+                }
+            }
+            else {
+                BBLID bblid = pickbbl(_rng);
+                COST delta = -_engine.FlipGain(bblid);
+                if (!Accept(delta, temperature, uniform(_rng))) continue;
+                if (delta > 0 && _best_pending) {
+                    _best = _engine.decision();
+                    _best_pending = false;
+                }
+                _engine.Flip(bblid);
+            }
+
+            if (_engine.Cost() < _best_cost) {
+                _best_cost = _engine.Cost();
+                _best_pending = true;
+            }
+        }
+        if (_best_pending) {
+            _best = _engine.decision();
+            _best_pending = false;
+        }
+        if (checkpoint != nullptr && _best_cost < offered_cost) {
+            checkpoint->Offer(_best, _best_cost);
+        }
+    }
+
+    inline const DECISION &best() const { return _best; }
+    inline COST BestCost() const { return _best_cost; }
+
+  private:
+    /// undo the segment move in _undo, save the decision, and redo the move
+    void SaveBestBeforeSegmentMove()
+    {
+        std::vector<std::pair<BBLID, CostSite>> redo;
+        for (auto undo = _undo.rbegin(); undo != _undo.rend(); ++undo) {
+            redo.push_back(std::make_pair(undo->first, _engine.site(undo->first)));
+            _engine.Assign(undo->first, undo->second);
+        }
+        _best = _engine.decision();
+        _best_pending = false;
+        for (auto &elem : redo) {
+            _engine.Assign(elem.first, elem.second);
+        }
+    }
+
+    inline static bool Accept(COST delta, double temperature, double dice)
+    {
+        if (delta <= 0) return true;
+        return dice < std::exp(-(double)delta / temperature);
+    }
+};
+
+} // namespace PIMProf
+
+#endif // __ANNEALING_H__
@@ -0,0 +1,259 @@
+//===- BranchAndBound.h - Exact depth-first decision search -----*- C++ -*-===//
+//
+//
+//===----------------------------------------------------------------------===//
+//
+//
+//===----------------------------------------------------------------------===//
+#ifndef __BRANCHANDBOUND_H__
+#define __BRANCHANDBOUND_H__
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <cassert>
+
+#include "Common.h"
+#include "IncrementalCost.h"
+#include "ThreadPool.h"
+#include "Checkpoint.h"
+
+namespace PIMProf
+{
+/* ===================================================================== */
+/* BranchAndBound */
+/* ===================================================================== */
+/// Assigns BBLs to CPU or PIM depth first, in descending order of |CPU - PIM| time,
+/// and prunes a subtree when its lower bound is no better than the incumbent.
+/// The lower bound of a partial decision is
+///     the elapsed time of the assigned BBLs
+///     + the minimum elapsed time of the unassigned BBLs
+///     + the switch cost between assigned BBLs
+///     + the reuse cost of segments that already have members on both sites,
+///       charged as the cheaper site if the head is unassigned.
+///
+/// The first SPLIT_BITS levels are expanded into independent subtrees that are
+/// handed out to the thread pool, sharing the incumbent.
+/// Improved incumbents are passed on to the checkpoint, whose time budget stops the search.
+class BranchAndBound
+{
+  public:
+    static const int SPLIT_BITS = 8;
+    static const uint64_t STOP_CHECK_INTERVAL = 1024;
+
+  private:
+    const CostIndex *_index = nullptr;
+    std::vector<BBLID> _order;
+    std::vector<CostSite> _prefer; // the site with smaller elapsed time
+    std::vector<COST> _suffix_min; // minimum elapsed time of _order[k], _order[k + 1], ...
+
+    std::mutex _mutex;
+    std::atomic<COST> _best_cost;
+    DECISION _best;
+
+    Checkpoint *_checkpoint = nullptr;
+    std::atomic<bool> _timeout;
+    std::atomic<uint64_t> _nodes;
+
+    /// a partial decision and its lower bound, owned by one worker
+    class Search
+    {
+      public:
+        BranchAndBound *_bnb;
+        const CostIndex *_index;
+        DECISION _decision;
+        std::vector<uint32_t> _leaf_site_count; // assigned members on CPU and PIM
+        COST _elapsed = 0;
+        COST _switch = 0;
+        COST _reuse = 0;
+        uint64_t _nodes = 0;
+
+        Search(BranchAndBound *bnb)
+            : _bnb(bnb), _index(bnb->_index),
+              _decision(_index->_size, INVALID),
+              _leaf_site_count(_index->LeafCount() * MAX_COST_SITE, 0)
+        {}
+
+        inline COST LeafCost(uint32_t leaf, CostSite headsite) const
+        {
+            const uint32_t *count = &_leaf_site_count[leaf * MAX_COST_SITE];
+            if (count[CPU] == 0 || count[PIM] == 0) return 0;
+            COST unit = (headsite == CPU || headsite == PIM)
+                ? _index->_mixed_cost[headsite]
+                : std::min(_index->_mixed_cost[CPU], _index->_mixed_cost[PIM]);
+            return _index->_leaf_count[leaf] * unit;
+        }
+
+        inline COST EdgeCost(uint32_t edge, CostSite fromsite, CostSite tosite) const
+        {
+            if (fromsite == INVALID || tosite == INVALID || fromsite == tosite)
+                return 0;
+            return _index->_switch_cost[fromsite] * _index->_edge_count[edge];
+        }
+
+        /// assign bblid to site (CPU or PIM), or unassign it with INVALID
+        void Assign(BBLID bblid, CostSite site)
+        {
+            CostSite oldsite = _decision[bblid];
+            if (oldsite == site) return;
+
+            if (oldsite != INVALID) _elapsed -= _index->_elapsed[oldsite][bblid];
+            if (site != INVALID) _elapsed += _index->_elapsed[site][bblid];
+
+            for (uint32_t i = _index->_bbl_edge_begin[bblid]; i < _index->_bbl_edge_begin[bblid + 1]; ++i) {
+                uint32_t e = _index->_bbl_edge[i];
+                BBLID from = _index->_edge_from[e];
+                BBLID to = _index->_edge_to[e];
+                CostSite fromsite = (from == bblid ? site : _decision[from]);
+                CostSite tosite = (to == bblid ? site : _decision[to]);
+                _switch += EdgeCost(e, fromsite, tosite) - EdgeCost(e, _decision[from], _decision[to]);
+            }
+
+            for (uint32_t i = _index->_bbl_leaf_begin[bblid]; i < _index->_bbl_leaf_begin[bblid + 1]; ++i) {
+                uint32_t leaf = _index->_bbl_leaf[i];
+                BBLID head = _index->_leaf_head[leaf];
+                uint32_t *count = &_leaf_site_count[leaf * MAX_COST_SITE];
+                COST oldcost = LeafCost(leaf, _decision[head]);
+                if (oldsite != INVALID) count[oldsite]--;
+                if (site != INVALID) count[site]++;
+                _reuse += LeafCost(leaf, head == bblid ? site : _decision[head]) - oldcost;
+            }
+
+            _decision[bblid] = site;
+        }
+
+        inline COST Bound(size_t depth) const
+        {
+            return _elapsed + _switch + _reuse + _bnb->_suffix_min[depth];
+        }
+
+        bool OutOfTime()
+        {
+            if (_bnb->_timeout) return true;
+            if (++_nodes % STOP_CHECK_INTERVAL == 0) {
+                _bnb->_nodes += STOP_CHECK_INTERVAL;
+                if (_bnb->_checkpoint != nullptr && _bnb->_checkpoint->Stopped()) {
+                    _bnb->_timeout = true;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /// Depth first search from the node at depth root. The path can be as long as
+        /// the number of BBLs, so it walks an explicit stack instead of recursing:
+        /// branch[depth - root] is the number of children entered at that depth.
+        void DFS(size_t root)
+        {
+            size_t size = _bnb->_order.size();
+            std::vector<char> branch(size - root + 1, 0);
+            size_t depth = root;
+            bool enter = true;
+            while (true) {
+                if (enter) {
+                    if (OutOfTime()) return;
+                    bool leaf = false;
+                    if (Bound(depth) >= _bnb->_best_cost) {
+                        leaf = true;
+                    }
+                    else if (depth == size) {
+                        _bnb->Offer(_decision, _elapsed + _switch + _reuse);
+                        leaf = true;
+                    }
+                    if (leaf) {
+                        if (depth == root) return;
+                        --depth;
+                        enter = false;
+                        continue;
+                    }
+                    branch[depth - root] = 0;
+                }
+
+                BBLID bblid = _bnb->_order[depth];
+                char &b = branch[depth - root];
+                if (b < 2) {
+                    CostSite first = _bnb->_prefer[bblid];
+                    CostSite second = (first == CPU ? PIM : CPU);
+                    Assign(bblid, b == 0 ? first : second);
+                    ++b;
+                    ++depth;
+                    enter = true;
+                }
+                else {
+                    Assign(bblid, INVALID);
+                    if (depth == root) return;
+                    --depth;
+                    enter = false;
+                }
+            }
+        }
+    };
+
+  public:
+    BranchAndBound(const CostIndex *index) : _index(index), _best_cost(MAX_COST), _timeout(false), _nodes(0)
+    {
+        BBLID size = _index->_size;
+        _prefer.resize(size);
+        for (BBLID i = 0; i < size; ++i) {
+            _order.push_back(i);
+            _prefer[i] = (_index->_elapsed[CPU][i] <= _index->_elapsed[PIM][i] ? CPU : PIM);
+        }
+        auto gap = [&](BBLID i) {
+            COST diff = _index->_elapsed[CPU][i] - _index->_elapsed[PIM][i];
+            return (diff < 0 ? -diff : diff);
+        };
+        std::stable_sort(_order.begin(), _order.end(), [&](BBLID l, BBLID r) { return gap(l) > gap(r); });
+
+        _suffix_min.assign(size + 1, 0);
+        for (BBLID k = size - 1; k >= 0; --k) {
+            BBLID i = _order[k];
+            _suffix_min[k] = _suffix_min[k + 1] + _index->_elapsed[_prefer[i]][i];
+        }
+    }
+
+    /// keep decision if it is better than the incumbent
+    void Offer(const DECISION &decision, COST cost)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (cost < _best_cost) {
+            _best_cost = cost;
+            _best = decision;
+            if (_checkpoint != nullptr) _checkpoint->Offer(decision, cost);
+        }
+    }
+
+    /// improved incumbents are offered to checkpoint from now on, including those of Solve
+    void SetCheckpoint(Checkpoint *checkpoint) { _checkpoint = checkpoint; }
+
+    /// returns true if the search finished, i.e., the incumbent is optimal,
+    /// and false if it was stopped by the checkpoint
+    bool Solve(ThreadPool *pool)
+    {
+        _timeout = false;
+
+        int split = std::min<size_t>(SPLIT_BITS, _order.size());
+        size_t subtrees = (size_t)1 << split;
+        pool->ParallelFor(subtrees, [&](int, size_t subtree) {
+            Search search(this);
+            // bit j of subtree chooses the second site of _order[j]
+            for (int j = 0; j < split; ++j) {
+                BBLID bblid = _order[j];
+                CostSite first = _prefer[bblid];
+                search.Assign(bblid, ((subtree >> (split - 1 - j)) & 1) ? (first == CPU ? PIM : CPU) : first);
+                if (search.Bound(j + 1) >= _best_cost) return;
+            }
+            search.DFS(split);
+            _nodes += search._nodes % STOP_CHECK_INTERVAL;
+        });
+        return !_timeout;
+    }
+
+    inline const DECISION &best() const { return _best; }
+    inline COST BestCost() const { return _best_cost; }
+    inline uint64_t nodes() const { return _nodes; }
+};
+
+} // namespace PIMProf
+
+#endif // __BRANCHANDBOUND_H__
@@ -0,0 +1,121 @@
+//===- Capacity.h - Budgets on the BBLs offloaded to PIM --------*- C++ -*-===//
+//
+//
+//===----------------------------------------------------------------------===//
+//
+//
+//===----------------------------------------------------------------------===//
+#ifndef __CAPACITY_H__
+#define __CAPACITY_H__
+
+#include <vector>
+#include <string>
+#include <cassert>
+
+#include "Common.h"
+
+namespace PIMProf
+{
+/* ===================================================================== */
+/* CapacityBudget */
+/* ===================================================================== */
+/// Knapsack budgets on the BBLs assigned to PIM: for every budget k,
+///     sum over BBLs i on PIM of _weight[k][i] <= _limit[k],
+/// and a forbidden BBL may not be assigned to PIM at all.
+/// Every budget only limits PIM, so the all CPU decision is always feasible.
+class CapacityBudget
+{
+  public:
+    BBLID _size = 0;
+    std::vector<std::string> _name;
+    std::vector<std::vector<double>> _weight; // [budget][BBLID]
+    std::vector<double> _limit;
+    std::vector<char> _forbidden;
+
+  public:
+    void initialize(BBLID size)
+    {
+        _size = size;
+        _name.clear();
+        _weight.clear();
+        _limit.clear();
+        _forbidden.assign(size, false);
+    }
+
+    /// a BBL of positive weight is forbidden if the limit is not positive
+    void AddBudget(const std::string &name, const std::vector<double> &weight, double limit)
+    {
+        assert((BBLID)weight.size() == _size);
+        _name.push_back(name);
+        _weight.push_back(weight);
+        _limit.push_back(limit);
+        if (limit > 0) return;
+        for (BBLID i = 0; i < _size; ++i) {
+            if (weight[i] > 0) Forbid(i);
+        }
+    }
+
+    inline void Forbid(BBLID bblid) { _forbidden[bblid] = true; }
+    inline bool forbidden(BBLID bblid) const { return _forbidden[bblid]; }
+    inline size_t size() const { return _limit.size(); }
+
+    /// the weight of the BBLs on PIM, per budget
+    std::vector<double> Usage(const DECISION &decision) const
+    {
+        std::vector<double> usage(size(), 0);
+        for (BBLID i = 0; i < _size; ++i) {
+            if (decision[i] != PIM) continue;
+            for (size_t k = 0; k < size(); ++k) {
+                usage[k] += _weight[k][i];
+            }
+        }
+        return usage;
+    }
+
+    bool Feasible(const DECISION &decision) const
+    {
+        for (BBLID i = 0; i < _size; ++i) {
+            if (decision[i] == PIM && forbidden(i)) return false;
+        }
+        std::vector<double> usage = Usage(decision);
+        for (size_t k = 0; k < size(); ++k) {
+            if (usage[k] > _limit[k]) return false;
+        }
+        return true;
+    }
+
+    /// whether bblid can join PIM on top of usage
+    bool Fits(const std::vector<double> &usage, BBLID bblid) const
+    {
+        if (forbidden(bblid)) return false;
+        for (size_t k = 0; k < size(); ++k) {
+            if (usage[k] + _weight[k][bblid] > _limit[k]) return false;
+        }
+        return true;
+    }
+
+    /// sum over positive budgets of weight / limit, so a feasible decision
+    /// puts a total normalized weight of at most Active() on PIM
+    double NormalizedWeight(BBLID bblid) const
+    {
+        double weight = 0;
+        for (size_t k = 0; k < size(); ++k) {
+            if (_limit[k] > 0) weight += _weight[k][bblid] / _limit[k];
+        }
+        return weight;
+    }
+
+    /// the number of positive budgets
+    size_t Active() const
+    {
+        size_t active = 0;
+        for (auto limit : _limit) {
+            if (limit > 0) active++;
+        }
+        return active;
+    }
+};
+
+} // namespace PIMProf
+
+#endif // __CAPACITY_H__
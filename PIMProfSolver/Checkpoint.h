@@ -0,0 +1,192 @@
+//===- Checkpoint.h - Time budget and best decision checkpoints -*- C++ -*-===//
+//
+//
+//===----------------------------------------------------------------------===//
+//
+//
+//===----------------------------------------------------------------------===//
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+
+#include "Common.h"
+#include "DecisionPool.h"
+
+namespace PIMProf
+{
+/* ===================================================================== */
+/* Checkpoint */
+/* ===================================================================== */
+/// Keeps the best decision found by a search mode, so that the search can stop
+/// when the time budget runs out or on SIGINT and still report a decision.
+///
+/// While it is started,
+///     <output>.partial is rewritten with the best decision at most every WRITE_INTERVAL seconds,
+///     <output>.convergence gets one "<seconds> <cost in ns>" line per improvement.
+/// Searches call Offer() with every complete decision they find and poll Stopped().
+/// If the searches work on a reduced problem, SetExpander() maps their decisions back.
+/// With SetTarget(), the searches also stop once a decision is no worse than the target.
+/// With SetPool(), every offered decision is also offered to the pool.
+class Checkpoint
+{
+  public:
+    typedef std::function<void(std::ostream &, const DECISION &, COST)> Writer;
+    typedef std::function<DECISION(const DECISION &)> Expander;
+    static constexpr double WRITE_INTERVAL = 1.0; // in seconds
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    bool _started = false;
+    std::string _partialfile;
+    Writer _writer;
+    Expander _expander;
+    COST _offset = 0; // added to the cost of offered decisions
+    DecisionPool *_pool = nullptr;
+    std::ofstream _log;
+
+    Clock::time_point _start;
+    Clock::time_point _deadline;
+    Clock::time_point _last_write;
+    bool _has_deadline = false;
+    COST _target = 0;
+    bool _has_target = false;
+
+    std::mutex _mutex;
+    std::atomic<COST> _best_cost;
+    DECISION _best;
+    bool _dirty = false; // _best has not been written yet
+
+    void (*_old_handler)(int) = SIG_DFL;
+
+    static volatile std::sig_atomic_t &Interrupted()
+    {
+        static volatile std::sig_atomic_t interrupted = 0;
+        return interrupted;
+    }
+
+    static void HandleInterrupt(int)
+    {
+        Interrupted() = 1;
+        // a second SIGINT terminates the solver
+        std::signal(SIGINT, SIG_DFL);
+    }
+
+  public:
+    Checkpoint() : _best_cost(MAX_COST) {}
+
+    ~Checkpoint() { Finish(); }
+
+    /// output is the output file of the solver, budget is in seconds (0 for unlimited)
+    void Start(const std::string &output, double budget, Writer writer)
+    {
+        _partialfile = output + ".partial";
+        _log.open(output + ".convergence", std::ofstream::out);
+        _writer = writer;
+        _expander = nullptr;
+        _offset = 0;
+        _pool = nullptr;
+        _start = _last_write = Clock::now();
+        _has_deadline = (budget > 0);
+        _has_target = false;
+        if (_has_deadline) {
+            _deadline = _start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(budget));
+        }
+        _best_cost = MAX_COST;
+        _best.clear();
+        _dirty = false;
+        Interrupted() = 0;
+        _old_handler = std::signal(SIGINT, HandleInterrupt);
+        _started = true;
+    }
+
+    /// write the best decision and stop handling SIGINT
+    void Finish()
+    {
+        if (!_started) return;
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_dirty) Write();
+        _log.close();
+        std::signal(SIGINT, _old_handler);
+        _started = false;
+    }
+
+    /// whether the search should stop, i.e., the time budget ran out, SIGINT was received
+    /// or the target was reached
+    inline bool Stopped() const
+    {
+        if (!_started) return false;
+        return Interrupted() || reached() || (_has_deadline && Clock::now() > _deadline);
+    }
+
+    inline bool interrupted() const { return Interrupted(); }
+    inline bool reached() const { return _has_target && _best_cost <= _target; }
+
+    void SetPool(DecisionPool *pool) { _pool = pool; }
+
+    /// e.g., the lower bound plus the tolerated gap
+    void SetTarget(COST target)
+    {
+        _target = target;
+        _has_target = true;
+    }
+
+    /// decisions offered from now on are expanded before they are written,
+    /// and offset is added to their cost
+    void SetExpander(Expander expander, COST offset)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _expander = expander;
+        _offset = offset;
+    }
+
+    /// keep decision if it is better than the best one so far, safe to call from workers
+    void Offer(const DECISION &decision, COST cost)
+    {
+        if (!_started) return;
+        cost += _offset;
+        if (_pool != nullptr) _pool->Offer(_expander ? _expander(decision) : decision, cost);
+        if (cost >= _best_cost) return;
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (cost >= _best_cost) return;
+        _best_cost = cost;
+        _best = decision;
+        _dirty = true;
+
+        Clock::time_point now = Clock::now();
+        _log << std::chrono::duration<double>(now - _start).count() << " " << CostToNs(cost) << std::endl;
+        if (now - _last_write >= std::chrono::duration<double>(WRITE_INTERVAL)) {
+            Write();
+        }
+    }
+
+    inline const DECISION &best() const { return _best; }
+    inline COST BestCost() const { return _best_cost; }
+
+  private:
+    /// write to a temporary file first, so that the pipeline never reads a truncated checkpoint
+    void Write()
+    {
+        std::string tmpfile = _partialfile + ".tmp";
+        {
+            std::ofstream ofs(tmpfile, std::ofstream::out);
+            _writer(ofs, _expander ? _expander(_best) : _best, _best_cost);
+        }
+        std::rename(tmpfile.c_str(), _partialfile.c_str());
+        _last_write = Clock::now();
+        _dirty = false;
+    }
+};
+
+} // namespace PIMProf
+
+#endif // __CHECKPOINT_H__
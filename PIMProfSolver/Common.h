@@ -12,6 +12,8 @@
 #include <vector>
 #include <map>
 #include <unordered_map>
+#include <limits>
+#include <cmath>
 
 namespace PIMProf {
 /* ===================================================================== */
@@ -40,10 +42,48 @@ static const std::string PThreadsIdentifier = "pthread_create";
 /* ===================================================================== */
 
 typedef uint32_t CACHE_STATS;
+#ifdef PIMPROF_FIXED_POINT_COST
+/// COST is an integer number of picoseconds, so sums of costs are exact
+/// and do not depend on the order of summation
+typedef int64_t COST;
+#else
 typedef double COST;
+#endif
 typedef int64_t BBLID;
 typedef std::pair<uint64_t, uint64_t> UUID;
 
+static const COST MAX_COST = std::numeric_limits<COST>::max();
+
+/// convert a time in nanoseconds (as printed in the stats files) to COST
+inline COST NsToCost(double ns)
+{
+#ifdef PIMPROF_FIXED_POINT_COST
+    return std::llround(ns * 1000);
+#else
+    return ns;
+#endif
+}
+
+/// convert a time in femtoseconds (as measured by the simulator) to COST
+inline COST FsToCost(uint64_t fs)
+{
+#ifdef PIMPROF_FIXED_POINT_COST
+    return (fs + 500) / 1000;
+#else
+    return (COST)fs / 1e6;
+#endif
+}
+
+/// convert COST to nanoseconds for printing
+inline double CostToNs(COST cost)
+{
+#ifdef PIMPROF_FIXED_POINT_COST
+    return cost / 1000.0;
+#else
+    return cost;
+#endif
+}
+
 // We use the last i64 to encode control bits, layout:
 // |    isomp    |   optype    |
 // 64            32            0
@@ -6,7 +6,6 @@
 //
 //===----------------------------------------------------------------------===//
 
-#include <cfloat>
 #include <climits>
 
 #include "Common.h"
@@ -17,23 +16,80 @@ using namespace PIMProf;
 /* ===================================================================== */
 /* CostSolver */
 /* ===================================================================== */
-// void CostSolver::BBL2Func(UUIDHashMap<ThreadRunStats *> &bbl, UUIDHashMap<ThreadRunStats *> &func)
-// {
-//     // func.clear();
-//     // for (auto &elem : bbl) {
-        
-//     // }
-// }
-
-// void CostSolver::BBL2Func(BBLIDDataReuse &bbl, FuncDataReuse &func)
-// {
-
-// }
+// BBLs are sorted by bblhash, so the BBLs of one function, which share bblhash.first, are adjacent.
+// Function i gets bblhash (function hash, 0), the total time, core time, instructions and memory
+// accesses of its BBLs, and their maximum parallelism.
+void CostSolver::BBL2Func(const SolverModel &bbl, SolverModel &func, std::vector<BBLID> &bbl2func)
+{
+    func._bblhash.clear();
+    for (int site = 0; site < MAX_COST_SITE; ++site) {
+        func._time[site].clear();
+        func._core_time[site].clear();
+        func._parallelism[site].clear();
+        func._instr[site].clear();
+        func._mem[site].clear();
+    }
+    bbl2func.resize(bbl.size());
+    for (size_t i = 0; i < bbl.size(); ++i) {
+        if (i == 0 || bbl._bblhash[i].first != bbl._bblhash[i - 1].first) {
+            func._bblhash.push_back(UUID(bbl._bblhash[i].first, 0));
+            for (int site = 0; site < MAX_COST_SITE; ++site) {
+                func._time[site].push_back(0);
+                func._core_time[site].push_back(0);
+                func._parallelism[site].push_back(0);
+                func._instr[site].push_back(0);
+                func._mem[site].push_back(0);
+            }
+        }
+        BBLID f = func.size() - 1;
+        bbl2func[i] = f;
+        for (int site = 0; site < MAX_COST_SITE; ++site) {
+            func._time[site][f] += bbl._time[site][i];
+            func._core_time[site][f] += bbl._core_time[site][i];
+            func._parallelism[site][f] = std::max(func._parallelism[site][f], bbl._parallelism[site][i]);
+            func._instr[site][f] += bbl._instr[site][i];
+            func._mem[site][f] += bbl._mem[site][i];
+        }
+    }
+}
 
-// void CostSolver::BBL2Func(SwitchCountList &bbl, SwitchCountList &func)
-// {
+// segments that fall into one function are dropped,
+// and segments that become the same function set with the same head are merged
+void CostSolver::BBL2Func(BBLIDDataReuse &bbl, BBLIDDataReuse &func, const std::vector<BBLID> &bbl2func)
+{
+    for (auto leaf : bbl.getLeaves()) {
+        BBLIDDataReuseSegment seg, funcseg;
+        bbl.ExportSegment(&seg, leaf);
+        for (auto elem : seg) {
+            funcseg.insert(bbl2func[elem]);
+        }
+        funcseg.setHead(bbl2func[seg.getHead()]);
+        funcseg.setCount(seg.getCount());
+        func.UpdateTrie(func.getRoot(), &funcseg);
+    }
+    func.SortLeaves();
+}
 
-// }
+// switches inside one function are dropped, and switches between the same functions are merged
+void CostSolver::BBL2Func(const FlatSwitchCountList &bbl, FlatSwitchCountList &func, const std::vector<BBLID> &bbl2func)
+{
+    std::vector<std::map<BBLID, uint64_t>> rows;
+    for (uint32_t row = 0; row < bbl.rows(); ++row) {
+        BBLID from = bbl2func[row];
+        if ((BBLID)rows.size() <= from) rows.resize(from + 1);
+        for (uint32_t e = bbl._row_begin[row]; e < bbl._row_begin[row + 1]; ++e) {
+            BBLID to = bbl2func[bbl._toidx[e]];
+            if (to != from) rows[from][to] += bbl.count(e);
+        }
+    }
+    SwitchCountList switchcnt;
+    for (BBLID from = 0; from < (BBLID)rows.size(); ++from) {
+        if (rows[from].empty()) continue;
+        switchcnt.RowInsert(from, std::vector<std::pair<int64_t, uint64_t>>(rows[from].begin(), rows[from].end()));
+    }
+    switchcnt.Sort();
+    func.initialize(switchcnt);
+}
 
 void CostSolver::initialize(CommandLineParser *parser)
 {
@@ -49,34 +105,93 @@ void CostSolver::initialize(CommandLineParser *parser)
     assert(reuse.is_open());
     ParseStats(cpustats, _bbl_hash2stats[CPU]);
     ParseStats(pimstats, _bbl_hash2stats[PIM]);
-    ParseReuse(reuse, _bbl_data_reuse, _bbl_switch_count);
-
-    // Convert BBLStats to FuncStats
-    // BBL2Func(_bbl_hash2stats[CPU], _func_hash2stats[CPU]);
-    // BBL2Func(_bbl_hash2stats[PIM], _func_hash2stats[PIM]);
-    // BBL2Func(_bbl_data_reuse, _func_data_reuse);
-    // BBL2Func(_bbl_switch_count, _func_switch_count);
+    for (auto &file : _command_line_parser->extrastatsfiles()) {
+        std::ifstream extrastats(file);
+        assert(extrastats.is_open());
+        _extra_hash2stats.emplace_back();
+        ParseStats(extrastats, _extra_hash2stats.back());
+    }
+    {
+        // the row form is only needed until it is flattened
+        SwitchCountList switchcnt;
+        ParseReuse(reuse, _bbl_data_reuse, switchcnt);
+        _bbl_flat_switch.initialize(switchcnt);
+    }
 
     // temporarily define flush and fetch cost here
-    _flush_cost[CostSite::CPU] = 60;
-    _flush_cost[CostSite::PIM] = 30;
-    _fetch_cost[CostSite::CPU] = 60;
-    _fetch_cost[CostSite::PIM] = 30;
-    _switch_cost[CostSite::CPU] = 2000;
-    _switch_cost[CostSite::PIM] = 2000;
+    _flush_cost[CostSite::CPU] = NsToCost(60);
+    _flush_cost[CostSite::PIM] = NsToCost(30);
+    _fetch_cost[CostSite::CPU] = NsToCost(60);
+    _fetch_cost[CostSite::PIM] = NsToCost(30);
+    _switch_cost[CostSite::CPU] = NsToCost(2000);
+    _switch_cost[CostSite::PIM] = NsToCost(2000);
+    for (int site = 0; site < MAX_COST_SITE; ++site) {
+        _mixed_cost[site] = MixedCost(_command_line_parser->coherence(), (CostSite)site);
+    }
     _mpki_threshold = 5;
     _parallelism_threshold = 15;
     _batch_threshold = 0.001;
-    _batch_size = 10;
+    _batch_size = _command_line_parser->batchsize();
+    _thread_pool = new ThreadPool(_command_line_parser->threads());
+
+    _bbl_data_reuse.SortLeaves();
+    _bbl_flat_reuse.initialize(_bbl_data_reuse.getRoot());
+    _reuse_constraints.initialize(_bbl_data_reuse);
+    _model.initialize(getBBLSortedStats());
+    BuildCostIndex();
+}
+
+void CostSolver::BuildCostIndex()
+{
+    _cost_index.initialize(_model._time, _bbl_data_reuse, _bbl_flat_switch, _mixed_cost, _switch_cost);
+    _search_index = &_cost_index;
+}
+
+// Only the modes that search over the CostIndex (mincut, bnb, anneal and component)
+// use the presolved core, the other modes work on the segments directly.
+void CostSolver::PrintPresolveStats()
+{
+    _presolve.initialize(&_cost_index);
+    _search_index = &_presolve.core();
+    const CostIndex &core = _presolve.core();
+    std::cout << "presolve: BBLs = " << _cost_index._size
+              << ", fixed = " << _presolve.fixed() << " (" << _presolve.isolated() << " isolated)"
+              << ", merged = " << _presolve.merged()
+              << ", core = " << core._size - _presolve.pinned() << " + " << _presolve.pinned() << " pinned"
+              << ", segments = " << _cost_index.LeafCount() << " -> " << core.LeafCount()
+              << ", switches = " << _cost_index.EdgeCount() << " -> " << core.EdgeCount() << std::endl;
+}
+
+// decisions of the original problem to and from decisions of _search_index
+DECISION CostSolver::ToSearch(const DECISION &decision)
+{
+    return (_search_index == &_cost_index ? decision : _presolve.Restrict(decision));
+}
+
+DECISION CostSolver::FromSearch(const DECISION &decision)
+{
+    return (_search_index == &_cost_index ? decision : _presolve.Expand(decision));
+}
+
+// the cost of the original problem that _search_index does not include
+COST CostSolver::SearchOffset()
+{
+    return (_search_index == &_cost_index ? 0 : _presolve.offset());
 }
 
 CostSolver::~CostSolver()
 {
+    delete _thread_pool;
     for (int i = 0; i < MAX_COST_SITE; i++) {
         for (auto it : _bbl_hash2stats[i]) {
             delete it.second;
         }
     }
+    for (auto &statsmap : _extra_hash2stats) {
+        for (auto it : statsmap) {
+            delete it.second;
+        }
+    }
 }
 
 const std::vector<ThreadRunStats *>* CostSolver::getBBLSortedStats()
@@ -126,11 +241,13 @@ void CostSolver::ParseStats(std::istream &ifs, UUIDHashMap<ThreadRunStats *> &st
         std::stringstream ss(line);
 
         RunStats bblstats;
+        double elapsed_time; // in nanoseconds
         ss >> bblstats.bblid
-           >> bblstats.elapsed_time
+           >> elapsed_time
            >> bblstats.instruction_count
            >> bblstats.memory_access
            >> std::hex >> bblstats.bblhash.first >> bblstats.bblhash.second;
+        bblstats.elapsed_time = NsToCost(elapsed_time);
         assert(bblstats.elapsed_time >= 0);
         auto it = statsmap.find(bblstats.bblhash);
         if (statsmap.find(bblstats.bblhash) == statsmap.end()) {
@@ -160,7 +277,7 @@ void CostSolver::PrintStats(std::ostream &ofs)
         {
             UUID bblhash = (*it)->bblhash;
             ofs << std::setw(7) << (*it)->bblid
-                << std::setw(15) << (*it)->elapsed_time
+                << std::setw(15) << CostToNs((*it)->elapsed_time)
                 << std::setw(15) << (*it)->instruction_count
                 << std::setw(15) << (*it)->memory_access
                 << "  " << std::hex
@@ -241,19 +358,77 @@ DECISION CostSolver::PrintSolution(std::ostream &ofs)
 {
     DECISION decision;
     
+    CommandLineParser::Mode mode = _command_line_parser->mode();
+    if (mode == CommandLineParser::Mode::REUSE || mode == CommandLineParser::Mode::DEBUG
+        || mode == CommandLineParser::Mode::BNB || mode == CommandLineParser::Mode::ANNEAL
+        || mode == CommandLineParser::Mode::COMPONENT || mode == CommandLineParser::Mode::MULTILEVEL
+        || mode == CommandLineParser::Mode::MULTISITE || mode == CommandLineParser::Mode::OVERLAP
+        || mode == CommandLineParser::Mode::CAPACITY || mode == CommandLineParser::Mode::REGION) {
+        _checkpoint.Start(_command_line_parser->outputfile(), _command_line_parser->timebudget(),
+            [this](std::ostream &out, const DECISION &best, COST cost) {
+                out << "Best offloading time so far (ns): " << CostToNs(cost) << std::endl;
+                PrintDecision(out, best, false);
+            });
+    }
+    if (mode == CommandLineParser::Mode::MULTISITE) {
+        // the decision is not a two site DECISION, so it is printed by PrintMultiSiteStats
+        PrintMultiSiteStats(ofs);
+        _checkpoint.Finish();
+        return DECISION();
+    }
+    if (_command_line_parser->presolve()
+        && (mode == CommandLineParser::Mode::MINCUT || mode == CommandLineParser::Mode::BNB
+            || mode == CommandLineParser::Mode::ANNEAL || mode == CommandLineParser::Mode::COMPONENT)) {
+        PrintPresolveStats();
+        _checkpoint.SetExpander([this](const DECISION &core) { return _presolve.Expand(core); }, _presolve.offset());
+    }
+
+    if (_command_line_parser->topk() > 0 && mode != CommandLineParser::Mode::OVERLAP) {
+        _pool.initialize(_command_line_parser->topk(), _command_line_parser->mindistance());
+        _checkpoint.SetPool(&_pool);
+    }
+
+    // the budgets are built before any decision is offered, so that the pool
+    // only keeps decisions that fit them
+    if (mode == CommandLineParser::Mode::CAPACITY) {
+        BuildCapacityBudget();
+        _pool.SetFilter([this](const DECISION &decision) { return _capacity.Feasible(decision); });
+    }
+    if (mode == CommandLineParser::Mode::REGION) {
+        _pool.SetFilter([this](const DECISION &decision) { return CountRegions(decision) <= MaxRegions(); });
+    }
+
+    if (mode == CommandLineParser::Mode::OVERLAP) {
+        BuildOverlapWindows();
+        std::cout << "overlap windows = " << _overlap_windows << std::endl;
+    }
+
+    // The bound costs an exact solve of the two site model, so it is only computed up front
+    // when asked for. Mincut mode takes it from its own cut, and capacity and region mode
+    // raise it with every cut of their search.
+    COST bound = 0;
+    bool hasbound = (mode == CommandLineParser::Mode::MINCUT || mode == CommandLineParser::Mode::CAPACITY
+        || mode == CommandLineParser::Mode::REGION);
+    if ((_command_line_parser->bound() || _command_line_parser->gap() >= 0) && mode != CommandLineParser::Mode::MINCUT) {
+        bound = (mode == CommandLineParser::Mode::OVERLAP ? LowerBound(OverlapRelaxation()) : LowerBound(_cost_index));
+        hasbound = true;
+    }
+    if (_command_line_parser->gap() >= 0) {
+        _checkpoint.SetTarget(bound + (COST)(_command_line_parser->gap() * bound));
+    }
+
     if (_command_line_parser->mode() == CommandLineParser::Mode::MPKI) {
-        ofs << "CPU only time (ns): " << ElapsedTime(CPU) << std::endl
-            << "PIM only time (ns): " << ElapsedTime(PIM) << std::endl;
+        ofs << "CPU only time (ns): " << CostToNs(ElapsedTime(CPU)) << std::endl
+            << "PIM only time (ns): " << CostToNs(ElapsedTime(PIM)) << std::endl;
         decision = PrintMPKIStats(ofs);
     }
     if (_command_line_parser->mode() == CommandLineParser::Mode::REUSE) {
-        ofs << "CPU only time (ns): " << ElapsedTime(CPU) << std::endl
-            << "PIM only time (ns): " << ElapsedTime(PIM) << std::endl;
+        ofs << "CPU only time (ns): " << CostToNs(ElapsedTime(CPU)) << std::endl
+            << "PIM only time (ns): " << CostToNs(ElapsedTime(PIM)) << std::endl;
 
-        const std::vector<ThreadRunStats *> *sorted = getBBLSortedStats();
         uint64_t instr_cnt = 0;
-        for (int i = 0; i < (int)sorted[CPU].size(); i++) {
-            instr_cnt += sorted[CPU][i]->instruction_count;
+        for (size_t i = 0; i < _model.size(); i++) {
+            instr_cnt += _model._instr[CPU][i];
         }
         ofs << "Instruction " << instr_cnt << std::endl;
         PrintMPKIStats(ofs);
@@ -261,16 +436,299 @@ DECISION CostSolver::PrintSolution(std::ostream &ofs)
         decision = PrintReuseStats(ofs);
     }
     if (_command_line_parser->mode() == CommandLineParser::Mode::DEBUG) {
-        ofs << "CPU only time (ns): " << ElapsedTime(CPU) << std::endl
-            << "PIM only time (ns): " << ElapsedTime(PIM) << std::endl;
+        ofs << "CPU only time (ns): " << CostToNs(ElapsedTime(CPU)) << std::endl
+            << "PIM only time (ns): " << CostToNs(ElapsedTime(PIM)) << std::endl;
         decision = Debug_HierarchicalDecision(ofs);
     }
+    if (_command_line_parser->mode() == CommandLineParser::Mode::MINCUT) {
+        ofs << "CPU only time (ns): " << CostToNs(ElapsedTime(CPU)) << std::endl
+            << "PIM only time (ns): " << CostToNs(ElapsedTime(PIM)) << std::endl;
+        PrintMPKIStats(ofs);
+        PrintGreedyStats(ofs);
+        decision = PrintMinCutStats(ofs, &bound);
+    }
+    if (_command_line_parser->mode() == CommandLineParser::Mode::BNB) {
+        ofs << "CPU only time (ns): " << CostToNs(ElapsedTime(CPU)) << std::endl
+            << "PIM only time (ns): " << CostToNs(ElapsedTime(PIM)) << std::endl;
+        std::vector<DECISION> initial;
+        initial.push_back(PrintMPKIStats(ofs));
+        initial.push_back(PrintGreedyStats(ofs));
+        decision = PrintBranchAndBoundStats(ofs, initial);
+    }
+    if (_command_line_parser->mode() == CommandLineParser::Mode::ANNEAL) {
+        ofs << "CPU only time (ns): " << CostToNs(ElapsedTime(CPU)) << std::endl
+            << "PIM only time (ns): " << CostToNs(ElapsedTime(PIM)) << std::endl;
+        std::vector<DECISION> initial;
+        initial.push_back(PrintGreedyStats(ofs));
+        initial.push_back(PrintMPKIStats(ofs));
+        decision = PrintAnnealingStats(ofs, initial);
+    }
+    if (_command_line_parser->mode() == CommandLineParser::Mode::COMPONENT) {
+        ofs << "CPU only time (ns): " << CostToNs(ElapsedTime(CPU)) << std::endl
+            << "PIM only time (ns): " << CostToNs(ElapsedTime(PIM)) << std::endl;
+        PrintMPKIStats(ofs);
+        PrintGreedyStats(ofs);
+        decision = PrintComponentStats(ofs);
+    }
+    if (_command_line_parser->mode() == CommandLineParser::Mode::MULTILEVEL) {
+        ofs << "CPU only time (ns): " << CostToNs(ElapsedTime(CPU)) << std::endl
+            << "PIM only time (ns): " << CostToNs(ElapsedTime(PIM)) << std::endl;
+        PrintMPKIStats(ofs);
+        PrintGreedyStats(ofs);
+        decision = PrintMultilevelStats(ofs);
+    }
+    if (_command_line_parser->mode() == CommandLineParser::Mode::OVERLAP) {
+        ofs << "CPU only time (ns): " << CostToNs(ElapsedTime(CPU)) << std::endl
+            << "PIM only time (ns): " << CostToNs(ElapsedTime(PIM)) << std::endl;
+        std::vector<DECISION> initial;
+        initial.push_back(PrintMPKIStats(ofs));
+        initial.push_back(PrintGreedyStats(ofs));
+        initial.push_back(PrintMinCutStats(ofs));
+        decision = PrintOverlapStats(ofs, initial);
+    }
+    if (_command_line_parser->mode() == CommandLineParser::Mode::CAPACITY) {
+        ofs << "CPU only time (ns): " << CostToNs(ElapsedTime(CPU)) << std::endl
+            << "PIM only time (ns): " << CostToNs(ElapsedTime(PIM)) << std::endl;
+        PrintMPKIStats(ofs);
+        PrintGreedyStats(ofs);
+        PrintMinCutStats(ofs);
+        decision = PrintCapacityStats(ofs, bound);
+    }
+    if (_command_line_parser->mode() == CommandLineParser::Mode::REGION) {
+        ofs << "CPU only time (ns): " << CostToNs(ElapsedTime(CPU)) << std::endl
+            << "PIM only time (ns): " << CostToNs(ElapsedTime(PIM)) << std::endl;
+        PrintMPKIStats(ofs);
+        PrintGreedyStats(ofs);
+        PrintMinCutStats(ofs);
+        decision = PrintRegionStats(ofs, bound);
+    }
+    double gap = 0;
+    if (hasbound) {
+        COST total = (mode == CommandLineParser::Mode::OVERLAP ? OverlapTotal(decision) : Cost(decision));
+        gap = (total > bound && bound > 0 ? (double)(total - bound) / bound : 0);
+        ofs << "Lower bound (ns): " << CostToNs(bound) << ", gap = " << gap * 100 << "%" << std::endl;
+    }
+
+    if (_checkpoint.interrupted()) {
+        std::cout << "interrupted, the best decision so far is reported" << std::endl;
+    }
+    else if (_checkpoint.reached()) {
+        std::cout << "stopped at gap " << gap * 100 << "%" << std::endl;
+    }
+    _checkpoint.Finish();
 
     PrintDecision(ofs, decision, false);
 
+    if (_command_line_parser->topk() > 0 && mode != CommandLineParser::Mode::OVERLAP) {
+        PrintTopK(decision);
+    }
+
     return decision;
 }
 
+// Sites are CPU, PIM, then PIM2, PIM3, ... in the order of the -x stats files.
+// Costs default to those of the two site model, where every extra site costs the same as PIM,
+// and can be overridden by the -m config file, in nanoseconds:
+//     [Switch] CPU/PIM2 = <switch cost from CPU to PIM2>
+//     [Flush]  PIM2 = <flush cost of PIM2>
+//     [Fetch]  PIM2 = <fetch cost of PIM2>
+void CostSolver::ReadConfig(ConfigReader &reader)
+{
+    SiteID sites = MAX_COST_SITE + _extra_hash2stats.size();
+    _site_name = { "CPU", "PIM" };
+    for (SiteID s = MAX_COST_SITE; s < sites; ++s) {
+        _site_name.push_back("PIM" + std::to_string(s));
+    }
+
+    // the site whose two site cost is the default
+    auto base = [](SiteID s) { return (s == CPU ? CPU : PIM); };
+    _site_flush_cost.resize(sites);
+    _site_fetch_cost.resize(sites);
+    _site_switch_cost.resize(sites * sites);
+    for (SiteID s = 0; s < sites; ++s) {
+        _site_flush_cost[s] = NsToCost(reader.GetReal("Flush", _site_name[s], CostToNs(_flush_cost[base(s)])));
+        _site_fetch_cost[s] = NsToCost(reader.GetReal("Fetch", _site_name[s], CostToNs(_fetch_cost[base(s)])));
+        for (SiteID t = 0; t < sites; ++t) {
+            COST cost = (s == t ? 0 : _switch_cost[base(s)]);
+            _site_switch_cost[s * sites + t] = NsToCost(reader.GetReal("Switch", _site_name[s] + "/" + _site_name[t], CostToNs(cost)));
+        }
+    }
+}
+
+// A mixed segment is charged the flush of the head site and the most expensive fetch
+// of the other sites, which is the two site reuse cost when there are only two sites.
+void CostSolver::BuildMultiSiteIndex()
+{
+    std::string config = _command_line_parser->costconfigfile();
+    ConfigReader reader(config);
+    assert(config == "" || reader.ParseError() == 0);
+    ReadConfig(reader);
+
+    SiteID sites = _site_name.size();
+    std::vector<std::vector<COST>> elapsed(sites);
+    elapsed[CPU] = _model._time[CPU];
+    elapsed[PIM] = _model._time[PIM];
+    for (SiteID s = MAX_COST_SITE; s < sites; ++s) {
+        // as for PIM, a BBL without stats takes no time
+        for (auto &hash : _model._bblhash) {
+            auto it = _extra_hash2stats[s - MAX_COST_SITE].find(hash);
+            elapsed[s].push_back(it == _extra_hash2stats[s - MAX_COST_SITE].end() ? 0 : it->second->MaxElapsedTime());
+        }
+    }
+
+    std::vector<COST> mixed_cost(sites, 0);
+    for (SiteID s = 0; s < sites; ++s) {
+        COST fetch = 0;
+        for (SiteID t = 0; t < sites; ++t) {
+            if (t != s) fetch = std::max(fetch, _site_fetch_cost[t]);
+        }
+        mixed_cost[s] = _site_flush_cost[s] + fetch;
+    }
+    _multi_index.initialize(&_cost_index, elapsed, mixed_cost, _site_switch_cost);
+}
+
+// Starts from the fastest site of each BBL and runs alpha expansion moves.
+// The lower bound is the min cut of a two site relaxation: CPU against the fastest
+// other site of each BBL, with the cheapest switch and reuse cost of any site.
+// Every decision costs at least as much as its CPU/non-CPU projection in the relaxation.
+void CostSolver::PrintMultiSiteStats(std::ostream &ofs)
+{
+    BuildMultiSiteIndex();
+    const MultiSiteIndex &model = _multi_index;
+    SiteID sites = model._sites;
+
+    MULTIDECISION start(model._size, 0);
+    CostIndex relaxed = _cost_index;
+    for (BBLID i = 0; i < model._size; ++i) {
+        relaxed._elapsed[PIM][i] = model._elapsed[PIM][i];
+        for (SiteID s = 1; s < sites; ++s) {
+            if (model._elapsed[s][i] < model._elapsed[start[i]][i]) start[i] = s;
+            relaxed._elapsed[PIM][i] = std::min(relaxed._elapsed[PIM][i], model._elapsed[s][i]);
+        }
+    }
+    COST min_mixed = *std::min_element(model._mixed_cost.begin(), model._mixed_cost.end());
+    COST min_switch = MAX_COST;
+    for (SiteID s = 0; s < sites; ++s) {
+        for (SiteID t = 0; t < sites; ++t) {
+            if (s != t) min_switch = std::min(min_switch, _site_switch_cost[s * sites + t]);
+        }
+    }
+    for (int s = 0; s < MAX_COST_SITE; ++s) {
+        relaxed._mixed_cost[s] = min_mixed;
+        relaxed._switch_cost[s] = min_switch;
+    }
+    COST bound;
+    MinCut(relaxed, &bound);
+    for (SiteID s = 0; s < sites; ++s) {
+        MULTIDECISION only(model._size, s);
+        ofs << _site_name[s] << " only time (ns): " << CostToNs(model.Cost(only)) << std::endl;
+    }
+
+    AlphaExpansion expansion(&model, start);
+    int sweeps = expansion.Run([this]() { return _checkpoint.Stopped(); });
+    std::cout << "alpha expansion: " << expansion.moves() << " moves in " << sweeps << " sweeps" << std::endl;
+
+    MULTIDECISION decision = expansion.decision();
+    std::vector<COST> elapsed;
+    COST reuse_cost, switch_cost;
+    COST total_time = model.Cost(decision, &elapsed, &reuse_cost, &switch_cost);
+
+    ofs << "MultiSite offloading time (ns): " << CostToNs(total_time) << " =";
+    for (SiteID s = 0; s < sites; ++s) {
+        ofs << " " << _site_name[s] << " " << CostToNs(elapsed[s]) << " +";
+    }
+    ofs << " REUSE " << CostToNs(reuse_cost) << " + SWITCH " << CostToNs(switch_cost) << std::endl;
+    double gap = (total_time > bound && bound > 0 ? (double)(total_time - bound) / bound : 0);
+    ofs << "Lower bound (ns): " << CostToNs(bound) << ", gap = " << gap * 100 << "%" << std::endl;
+
+    PrintMultiSiteDecision(ofs, decision);
+}
+
+std::ostream &CostSolver::PrintMultiSiteDecision(std::ostream &ofs, const MULTIDECISION &decision)
+{
+    ofs << HORIZONTAL_LINE << std::endl;
+    ofs << std::setw(7) << "BBLID"
+        << std::setw(10) << "Decision";
+    for (auto &name : _site_name) {
+        ofs << std::setw(15) << name;
+    }
+    ofs << std::setw(21) << "Hash(hi)"
+        << std::setw(21) << "Hash(lo)"
+        << std::endl;
+    for (uint32_t i = 0; i < _model.size(); i++) {
+        ofs << std::setw(7) << i
+            << std::setw(10) << _site_name[decision[i]];
+        for (SiteID s = 0; s < _multi_index._sites; ++s) {
+            ofs << std::setw(15) << CostToNs(_multi_index._elapsed[s][i]);
+        }
+        ofs << "  "
+            << std::setw(21) << (int64_t)_model._bblhash[i].first
+            << "  "
+            << std::setw(21) << (int64_t)_model._bblhash[i].second
+            << std::endl;
+    }
+    return ofs;
+}
+
+// rounds of candidate generation per requested decision of --top-k
+static const size_t TOPK_ROUNDS_PER_DECISION = 4;
+
+// The pool already has the decisions offered to the checkpoint by the search.
+// More candidates are derived from decision: each round flips the BBLs that lose
+// the least, one at a time, until the candidate is the minimum distance away,
+// then improves the other BBLs by single flips. A BBL is only forced in one round.
+// Candidates rejected by the pool filter of the mode are dropped.
+// The i-th best decision is written to <output_file>.top<i>.
+void CostSolver::PrintTopK(const DECISION &decision)
+{
+    size_t k = _command_line_parser->topk();
+    BBLID distance = _pool.MinDistance();
+    BBLID size = _cost_index._size;
+    _pool.Offer(decision, Cost(decision));
+
+    std::vector<uint8_t> used(size, 0);
+    for (size_t round = 0; round < TOPK_ROUNDS_PER_DECISION * k; ++round) {
+        IncrementalCost engine(&_cost_index, decision);
+        std::vector<uint8_t> forced(size, 0);
+        BBLID flipped = 0;
+        for (; flipped < distance; ++flipped) {
+            BBLID best = -1;
+            COST best_gain = 0;
+            for (BBLID i = 0; i < size; ++i) {
+                if (used[i] || forced[i]) continue;
+                COST gain = engine.FlipGain(i);
+                if (best < 0 || gain > best_gain) {
+                    best = i;
+                    best_gain = gain;
+                }
+            }
+            if (best < 0) break;
+            engine.Flip(best);
+            forced[best] = used[best] = 1;
+        }
+        if (flipped < distance) break;
+
+        bool improved = true;
+        while (improved) {
+            improved = false;
+            for (BBLID i = 0; i < size; ++i) {
+                if (!forced[i] && engine.FlipGain(i) > 0) {
+                    engine.Flip(i);
+                    improved = true;
+                }
+            }
+        }
+        _pool.Offer(engine.decision(), engine.Cost());
+    }
+
+    std::cout << "top-k: " << _pool.size() << " decisions, at least " << distance << " BBLs apart" << std::endl;
+    for (size_t i = 0; i < _pool.size(); ++i) {
+        std::ofstream out(_command_line_parser->outputfile() + ".top" + std::to_string(i + 1), std::ofstream::out);
+        PrintCostLine(out, "Top " + std::to_string(i + 1), _pool.decision(i));
+        PrintDecision(out, _pool.decision(i), false);
+    }
+}
+
 // std::ostream & CostSolver::PrintDecision(std::ostream &ofs, const DECISION &decision, bool toscreen)
 // {
 //     const std::vector<ThreadRunStats *> *sorted = getBBLSortedStats();
@@ -315,7 +773,6 @@ DECISION CostSolver::PrintSolution(std::ostream &ofs)
 
 std::ostream & CostSolver::PrintDecision(std::ostream &ofs, const DECISION &decision, bool toscreen)
 {
-    const std::vector<ThreadRunStats *> *sorted = getBBLSortedStats();
     ofs << HORIZONTAL_LINE << std::endl;
     if (toscreen == true) {
         for (uint32_t i = 0; i < decision.size(); i++) {
@@ -335,20 +792,18 @@ std::ostream & CostSolver::PrintDecision(std::ostream &ofs, const DECISION &deci
             << std::setw(21) << "Hash(hi)"
             << std::setw(21) << "Hash(lo)"
             << std::endl;
-        for (uint32_t i = 0; i < sorted[CPU].size(); i++) {
-            auto *cpustats = sorted[CPU][i];
-            auto *pimstats = sorted[PIM][i];
-            COST diff = cpustats->MaxElapsedTime() - pimstats->MaxElapsedTime();
+        for (uint32_t i = 0; i < _model.size(); i++) {
+            COST diff = _model._time[CPU][i] - _model._time[PIM][i];
             ofs << std::setw(7) << i
                 << std::setw(10) << getCostSiteString(decision[i])
-                << std::setw(14) << pimstats->parallelism()
-                << std::setw(15) << cpustats->MaxElapsedTime()
-                << std::setw(15) << pimstats->MaxElapsedTime()
-                << std::setw(15) << diff
+                << std::setw(14) << _model._parallelism[PIM][i]
+                << std::setw(15) << CostToNs(_model._time[CPU][i])
+                << std::setw(15) << CostToNs(_model._time[PIM][i])
+                << std::setw(15) << CostToNs(diff)
                 << "  "
-                << std::setw(21) << (int64_t)cpustats->bblhash.first
+                << std::setw(21) << (int64_t)_model._bblhash[i].first
                 << "  "
-                << std::setw(21) << (int64_t)cpustats->bblhash.second
+                << std::setw(21) << (int64_t)_model._bblhash[i].second
                 << std::setfill(' ') << std::endl;
         }
     }
@@ -357,26 +812,22 @@ std::ostream & CostSolver::PrintDecision(std::ostream &ofs, const DECISION &deci
 
 DECISION CostSolver::PrintMPKIStats(std::ostream &ofs)
 {
-    const std::vector<ThreadRunStats *> *sorted = getBBLSortedStats();
     DECISION decision;
     uint64_t pim_total_instr = 0;
-    for (auto it = sorted[PIM].begin(); it != sorted[PIM].end(); ++it) {
-        pim_total_instr += (*it)->instruction_count;
+    for (auto instr : _model._instr[PIM]) {
+        pim_total_instr += instr;
     }
 
     uint64_t instr_threshold = pim_total_instr * 0.01;
     
-    for (BBLID i = 0; i < (BBLID)sorted[CPU].size(); ++i) {
-        auto *cpustats = sorted[CPU][i];
-        auto *pimstats = sorted[PIM][i];
-
-        double instr = pimstats->instruction_count;
-        double mem = pimstats->memory_access;
+    for (BBLID i = 0; i < (BBLID)_model.size(); ++i) {
+        double instr = _model._instr[PIM][i];
+        double mem = _model._mem[PIM][i];
         double mpki = mem / instr * 1000.0;
-        int para = pimstats->parallelism();
+        int para = _model._parallelism[PIM][i];
 
         // deal with the part that is not inside any BBL
-        if (cpustats->bblhash == GLOBAL_BBLHASH) {
+        if (_model._bblhash[i] == GLOBAL_BBLHASH) {
             decision.push_back(CostSite::CPU);
             continue;
         }
@@ -390,72 +841,159 @@ DECISION CostSolver::PrintMPKIStats(std::ostream &ofs)
         }
     }
 
-    COST reuse_cost = ReuseCost(decision, _bbl_data_reuse.getRoot());
-    COST switch_cost = SwitchCost(decision, _bbl_switch_count);
-    auto elapsed_time = ElapsedTime(decision);
-    COST total_time = reuse_cost + switch_cost + elapsed_time.first + elapsed_time.second;
-    assert(total_time == Cost(decision, _bbl_data_reuse.getRoot(), _bbl_switch_count));
-
-    ofs << "MPKI offloading time (ns): " << total_time << " = CPU " << elapsed_time.first << " + PIM " << elapsed_time.second << " + REUSE " << reuse_cost << " + SWITCH " << switch_cost << std::endl;
+    PrintCostLine(ofs, "MPKI", decision);
 
     return decision;
 }
 
 DECISION CostSolver::PrintGreedyStats(std::ostream &ofs)
 {
-    const std::vector<ThreadRunStats *> *sorted = getBBLSortedStats();
     DECISION decision;
-    for (BBLID i = 0; i < (BBLID)sorted[CPU].size(); ++i) {
-        auto *cpustats = sorted[CPU][i];
-        auto *pimstats = sorted[PIM][i];
-        if (cpustats->MaxElapsedTime() <= pimstats->MaxElapsedTime()) {
+    for (BBLID i = 0; i < (BBLID)_model.size(); ++i) {
+        if (_model._time[CPU][i] <= _model._time[PIM][i]) {
             decision.push_back(CPU);
         }
         else {
             decision.push_back(PIM);
         }
     }
-    COST reuse_cost = ReuseCost(decision, _bbl_data_reuse.getRoot());
-    COST switch_cost = SwitchCost(decision, _bbl_switch_count);
-    auto elapsed_time = ElapsedTime(decision);
-    COST total_time = reuse_cost + switch_cost + elapsed_time.first + elapsed_time.second;
-    assert(total_time == Cost(decision, _bbl_data_reuse.getRoot(), _bbl_switch_count));
-
-    ofs << "Greedy offloading time (ns): " << total_time << " = CPU " << elapsed_time.first << " + PIM " << elapsed_time.second << " + REUSE " << reuse_cost << " + SWITCH " << switch_cost << std::endl;
+    PrintCostLine(ofs, "Greedy", decision);
 
     return decision;
 }
 
 
-// this function does not check whether there is duplicate BBLID in cur_batch
-COST CostSolver::PermuteDecision(DECISION &decision, const std::vector<BBLID> &cur_batch, const BBLIDTrieNode *partial_root)
-{
+// batches of at least this size are split into 2^PERMUTE_SPLIT_BITS chunks by the
+// highest bits of the mask, and the chunks are searched by the thread pool.
+// The split does not depend on the number of threads, so the result does not either.
+static const int PARALLEL_PERMUTE_BATCH_SIZE = 16;
+static const int PERMUTE_SPLIT_BITS = 8;
+
+// annealing moves per BBL of a component that is too large to enumerate
+static const uint64_t COMPONENT_ITERATIONS_PER_BBL = 100;
 
+// this function does not check whether there is duplicate BBLID in cur_batch.
+// Callers that already run on the thread pool must pass parallel = false.
+// The assignments of the batch are enumerated in Gray code order,
+// so that each step moves exactly one BBL and the cost is updated incrementally.
+// Bit j of a mask means cur_batch[j] is put on PIM,
+// and the mask with the minimum cost wins, ties go to the lower mask.
+COST CostSolver::PermuteDecision(IncrementalCost &engine, const std::vector<BBLID> &cur_batch, bool parallel)
+{
     int cur_batch_size = cur_batch.size();
     assert(cur_batch_size < 64);
-    COST cur_total = FLT_MAX;
-    DECISION temp_decision = decision;
-    // find optimal in this batch
-    uint64_t permute = (1 << cur_batch_size) - 1;
-    
-    for (; permute != (uint64_t)(-1); permute--) {
-        for (int j = 0; j < cur_batch_size; j++) {
-            if ((permute >> j) & 1)
-                temp_decision[cur_batch[j]] = PIM;
-            else
-                temp_decision[cur_batch[j]] = CPU;
+
+    for (int j = 0; j < cur_batch_size; j++) {
+        engine.Assign(cur_batch[j], CPU);
+    }
+    uint64_t min_mask = 0;
+    COST cur_total = engine.Cost();
+
+    if (!parallel || cur_batch_size < PARALLEL_PERMUTE_BATCH_SIZE) {
+        uint64_t mask = 0;
+        uint64_t permute_size = (uint64_t)1 << cur_batch_size;
+        for (uint64_t i = 1; i < permute_size; i++) {
+            int j = __builtin_ctzll(i);
+            mask ^= ((uint64_t)1 << j);
+            engine.Flip(cur_batch[j]);
+            COST temp_total = engine.Cost();
+            if (temp_total < cur_total || (temp_total == cur_total && mask < min_mask)) {
+                cur_total = temp_total;
+                min_mask = mask;
+            }
         }
-        // PrintDecision(std::cout, temp_decision, true);
-        COST temp_total = Cost(temp_decision, partial_root, _bbl_switch_count);
-        if (temp_total < cur_total) {
-            cur_total = temp_total;
-            decision = temp_decision; 
+    }
+    else {
+        // each worker keeps its own scratch copy of the engine
+        int low_bits = cur_batch_size - PERMUTE_SPLIT_BITS;
+        size_t chunk_num = (size_t)1 << PERMUTE_SPLIT_BITS;
+        std::vector<std::pair<COST, uint64_t>> chunk_min(chunk_num);
+        std::vector<char> synced(_thread_pool->size(), false);
+        _permute_scratch.resize(_thread_pool->size());
+        COST base_total = cur_total;
+
+        _thread_pool->ParallelFor(chunk_num, [&](int worker, size_t chunk) {
+            // skipped chunks never win, unless all chunks are skipped and the batch stays on CPU
+            if (_checkpoint.Stopped()) {
+                chunk_min[chunk] = std::make_pair(MAX_COST, (uint64_t)0);
+                return;
+            }
+            IncrementalCost &scratch = _permute_scratch[worker];
+            if (!synced[worker]) {
+                scratch = engine;
+                synced[worker] = true;
+            }
+            chunk_min[chunk] = PermuteChunk(scratch, cur_batch, low_bits, chunk, base_total);
+        });
+
+        cur_total = chunk_min[0].first;
+        min_mask = chunk_min[0].second;
+        for (auto &elem : chunk_min) {
+            if (elem.first < cur_total || (elem.first == cur_total && elem.second < min_mask)) {
+                cur_total = elem.first;
+                min_mask = elem.second;
+            }
         }
     }
 
+    for (int j = 0; j < cur_batch_size; j++) {
+        engine.Assign(cur_batch[j], ((min_mask >> j) & 1) ? PIM : CPU);
+    }
     return cur_total;
 }
 
+// search all masks whose bits above low_bits equal chunk, return the best (cost, mask).
+// The cost is accumulated from the deltas along a fixed path starting from the batch
+// all on CPU, so it only depends on the chunk and not on the history of scratch.
+std::pair<COST, uint64_t> CostSolver::PermuteChunk(IncrementalCost &scratch, const std::vector<BBLID> &cur_batch, int low_bits, uint64_t chunk, COST base_total)
+{
+    int cur_batch_size = cur_batch.size();
+    for (int j = 0; j < cur_batch_size; j++) {
+        scratch.Assign(cur_batch[j], CPU);
+    }
+
+    uint64_t mask = chunk << low_bits;
+    COST total = base_total;
+    for (int j = low_bits; j < cur_batch_size; j++) {
+        if ((mask >> j) & 1) {
+            total += scratch.Delta(cur_batch[j], PIM);
+            scratch.Assign(cur_batch[j], PIM);
+        }
+    }
+
+    std::pair<COST, uint64_t> result(total, mask);
+    uint64_t permute_size = (uint64_t)1 << low_bits;
+    for (uint64_t i = 1; i < permute_size; i++) {
+        int j = __builtin_ctzll(i);
+        mask ^= ((uint64_t)1 << j);
+        CostSite site = (scratch.site(cur_batch[j]) == CPU ? PIM : CPU);
+        total += scratch.Delta(cur_batch[j], site);
+        scratch.Assign(cur_batch[j], site);
+        if (total < result.first || (total == result.first && mask < result.second)) {
+            result = std::make_pair(total, mask);
+        }
+    }
+    return result;
+}
+
+// swap each BBL in turn and keep the swap if it does not increase the total cost,
+// the cost change of each swap is evaluated incrementally
+COST CostSolver::SingleFlipSearch(DECISION &decision, int iterations)
+{
+    IncrementalCost engine(&_cost_index, decision);
+    std::cout << "cur_total = " << CostToNs(engine.Cost()) << std::endl;
+    for (int j = 0; j < iterations; j++) {
+        for (BBLID id = 0; id < (BBLID)decision.size(); id++) {
+            if (engine.FlipGain(id) >= 0) {
+                engine.Flip(id);
+            }
+        }
+        std::cout << "cur_total = " << CostToNs(engine.Cost()) << std::endl;
+    }
+    decision = engine.decision();
+    return engine.Cost();
+}
+
 // DECISION CostSolver::PrintReuseStats(std::ostream &ofs)
 // {
 //     _bbl_data_reuse.SortLeaves();
@@ -465,7 +1003,7 @@ COST CostSolver::PermuteDecision(DECISION &decision, const std::vector<BBLID> &c
 //     //initialize all decision to INVALID
 //     DECISION decision;
 //     decision.resize(_bbl_hash2stats[CPU].size(), INVALID);
-//     COST cur_total = FLT_MAX;
+//     COST cur_total = MAX_COST;
 //     int seg_count = INT_MAX;
 
 //     BBLIDTrieNode *partial_root = new BBLIDTrieNode();
@@ -503,7 +1041,7 @@ COST CostSolver::PermuteDecision(DECISION &decision, const std::vector<BBLID> &c
 //             std::cout << elem << getCostSiteString(decision[elem]) << " ";
 //         }
 
-//         std::cout << "seg_count = " << seg_count << ", reuse_max = " << reuse_max << ", cur_total = " << cur_total << std::endl;
+//         std::cout << "seg_count = " << seg_count << ", reuse_max = " << CostToNs(reuse_max) << ", cur_total = " << CostToNs(cur_total) << std::endl;
 //         std::cout << std::endl;
 //         if (seg_count * reuse_max < _batch_threshold * cur_total) break;
 //         batch_cnt++;
@@ -531,14 +1069,14 @@ COST CostSolver::PermuteDecision(DECISION &decision, const std::vector<BBLID> &c
 //         }
 //     }
 
-//     cur_total = Cost(decision, _bbl_data_reuse.getRoot(), _bbl_switch_count);
+//     cur_total = Cost(decision);
 //     std::cout << "cur_total = " << cur_total << std::endl;
 //     // iterate over the remaining BBs 5 times until convergence
 //     for (int j = 0; j < 2; ++j) {
 //         for (BBLID id = 0; id < (BBLID)sorted[CPU].size(); id++) {
 //             // swap decision[id] and check if it reduces overhead
 //             decision[id] = (decision[id] == CPU ? PIM : CPU);
-//             COST temp_total = Cost(decision, _bbl_data_reuse.getRoot(), _bbl_switch_count);
+//             COST temp_total = Cost(decision);
 //             if (temp_total > cur_total) {
 //                 decision[id] = (decision[id] == CPU ? PIM : CPU);
 //             }
@@ -549,20 +1087,21 @@ COST CostSolver::PermuteDecision(DECISION &decision, const std::vector<BBLID> &c
 //         std::cout << "cur_total = " << cur_total << std::endl;
 //     }
 
-//     COST reuse_cost = ReuseCost(decision, _bbl_data_reuse.getRoot());
-//     COST switch_cost = SwitchCost(decision, _bbl_switch_count);
+//     COST reuse_cost = ReuseCost(decision);
+//     COST switch_cost = SwitchCost(decision, _bbl_flat_switch);
 //     auto elapsed_time = ElapsedTime(decision);
 //     COST total_time = reuse_cost + switch_cost + elapsed_time.first + elapsed_time.second;
-//     assert(total_time == Cost(decision, _bbl_data_reuse.getRoot(), _bbl_switch_count));
+//     assert(total_time == Cost(decision));
 
-//     ofs << "Reuse offloading time (ns): " << total_time << " = CPU " << elapsed_time.first << " + PIM " << elapsed_time.second << " + REUSE " << reuse_cost << " + SWITCH " << switch_cost << std::endl;
+//     ofs << "Reuse offloading time (ns): " << CostToNs(total_time) << " = CPU " << CostToNs(elapsed_time.first) << " + PIM " << CostToNs(elapsed_time.second) << " + REUSE " << CostToNs(reuse_cost) << " + SWITCH " << CostToNs(switch_cost) << std::endl;
 
 //     return decision;
 // }
 
 void CostSolver::PrintDisjointSets(std::ostream &ofs)
 {
-    DisjointSet ds;
+    DisjointSet ds(_model.size());
+    std::vector<bool> inserted(_model.size(), false);
     _bbl_data_reuse.SortLeaves();
 
     COST elapsed_time_min = (ElapsedTime(CPU) < ElapsedTime(PIM) ? ElapsedTime(CPU) : ElapsedTime(PIM));
@@ -574,27 +1113,147 @@ void CostSolver::PrintDisjointSets(std::ostream &ofs)
         BBLID first = *seg.begin();
         for (auto elem : seg) {
             ds.Union(first, elem);
+            inserted[elem] = true;
         }
         if (seg.getCount() * reuse_max < _batch_threshold * elapsed_time_min) break;
     }
 
-    for (auto it : ds.parent) {
-        ofs << it.first << " " << it.second << std::endl;
+    for (BBLID i = 0; i < ds.size(); ++i) {
+        if (inserted[i]) ofs << i << " " << ds.parent[i] << std::endl;
     }
-    
-    for (auto it : ds.parent) {
-        if (ds.Find(it.first) == it.first) {
-            BBLID head = it.first;
-            int count = 0;
-            for (auto it2 : ds.parent) {
-                if (ds.Find(it2.first) == head) {
-                    ofs << it2.first << " ";
-                     count++;
-                }
+
+    std::vector<std::vector<BBLID>> sets(ds.size());
+    for (BBLID i = 0; i < ds.size(); ++i) {
+        if (inserted[i]) sets[ds.Find(i)].push_back(i);
+    }
+    for (auto &set : sets) {
+        if (set.empty()) continue;
+        for (auto elem : set) {
+            ofs << elem << " ";
+        }
+        ofs << " | Count = " << set.size() << std::endl;
+    }
+}
+
+// BBLs are connected if they share a reuse segment or a switch edge,
+// components are ordered by their smallest BBLID
+std::vector<std::vector<BBLID>> CostSolver::BuildComponents(const CostIndex &index)
+{
+    DisjointSet ds(index._size);
+    for (uint32_t leaf = 0; leaf < index.LeafCount(); ++leaf) {
+        for (uint32_t m = index._leaf_begin[leaf] + 1; m < index._leaf_begin[leaf + 1]; ++m) {
+            ds.Union(index._leaf_member[index._leaf_begin[leaf]], index._leaf_member[m]);
+        }
+    }
+    for (uint32_t e = 0; e < index.EdgeCount(); ++e) {
+        ds.Union(index._edge_from[e], index._edge_to[e]);
+    }
+
+    std::vector<std::vector<BBLID>> components;
+    std::vector<BBLID> component_of(index._size, -1);
+    for (BBLID i = 0; i < index._size; ++i) {
+        BBLID root = ds.Find(i);
+        if (component_of[root] < 0) {
+            component_of[root] = components.size();
+            components.emplace_back();
+        }
+        components[component_of[root]].push_back(i);
+    }
+    return components;
+}
+
+// enumerate all decisions of a component smaller than the batch size,
+// otherwise anneal from the greedy decision and finish with single flips.
+// Called by the workers of the thread pool, so nothing here may use the pool.
+DECISION CostSolver::SolveComponent(const CostIndex &index)
+{
+    DECISION decision(index._size);
+    for (BBLID i = 0; i < index._size; ++i) {
+        decision[i] = (index._elapsed[CPU][i] <= index._elapsed[PIM][i] ? CPU : PIM);
+    }
+    if (index._size < _batch_size) {
+        IncrementalCost engine(&index, decision);
+        std::vector<BBLID> cur_batch(index._size);
+        for (BBLID i = 0; i < index._size; ++i) {
+            cur_batch[i] = i;
+        }
+        PermuteDecision(engine, cur_batch, false);
+        return engine.decision();
+    }
+
+    AnnealingSchedule schedule = MakeAnnealingSchedule(index, COMPONENT_ITERATIONS_PER_BBL * index._size);
+    AnnealingChain annealing(&index, decision, _command_line_parser->seed());
+    annealing.Run(schedule);
+
+    IncrementalCost engine(&index, annealing.best());
+    bool improved = true;
+    while (improved) {
+        improved = false;
+        for (BBLID i = 0; i < index._size; ++i) {
+            if (engine.FlipGain(i) > 0) {
+                engine.Flip(i);
+                improved = true;
+            }
+        }
+    }
+    return engine.decision();
+}
+
+DECISION CostSolver::PrintComponentStats(std::ostream &ofs)
+{
+    const CostIndex &search = *_search_index;
+    std::vector<std::vector<BBLID>> components = BuildComponents(search);
+
+    // position of each BBL in its component
+    std::vector<BBLID> local(search._size);
+    for (auto &component : components) {
+        for (BBLID i = 0; i < (BBLID)component.size(); ++i) {
+            local[component[i]] = i;
+        }
+    }
+
+    // hand out the largest components first, so that they do not end up last on one worker
+    std::vector<size_t> order(components.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t l, size_t r) {
+        return components[l].size() > components[r].size();
+    });
+
+    std::vector<DECISION> component_decision(components.size());
+    _thread_pool->ParallelFor(order.size(), [&](int, size_t i) {
+        const std::vector<BBLID> &component = components[order[i]];
+        DECISION &result = component_decision[order[i]];
+        if (_checkpoint.Stopped()) {
+            // fall back to the faster site of each BBL
+            for (auto bblid : component) {
+                result.push_back(search._elapsed[CPU][bblid] <= search._elapsed[PIM][bblid] ? CPU : PIM);
             }
-            ofs << " | Count = " << count << std::endl;
+            return;
+        }
+        CostIndex index;
+        index.initialize(search, component, local);
+        result = SolveComponent(index);
+    });
+
+    DECISION searchdecision(search._size, INVALID);
+    size_t largest = 0, exhaustive = 0;
+    for (size_t c = 0; c < components.size(); ++c) {
+        for (size_t i = 0; i < components[c].size(); ++i) {
+            searchdecision[components[c][i]] = component_decision[c][i];
         }
+        largest = std::max(largest, components[c].size());
+        if ((int)components[c].size() < _batch_size) exhaustive++;
     }
+    std::cout << "components = " << components.size() << ", largest = " << largest
+              << ", exhaustive = " << exhaustive << ", annealed = " << components.size() - exhaustive << std::endl;
+
+    DECISION decision = FromSearch(searchdecision);
+    COST total_time = PrintCostLine(ofs, "Component", decision);
+    _checkpoint.Offer(searchdecision, total_time - SearchOffset());
+
+    return decision;
 }
 
 DECISION CostSolver::Debug_StartFromUnimportantSegment(std::ostream &ofs)
@@ -612,10 +1271,10 @@ DECISION CostSolver::Debug_StartFromUnimportantSegment(std::ostream &ofs)
     //initialize all decision to INVALID
     DECISION decision;
     decision.resize(_bbl_hash2stats[CPU].size(), INVALID);
-    COST cur_total = FLT_MAX;
+    COST cur_total = MAX_COST;
 
-    BBLIDTrieNode *partial_root = new BBLIDTrieNode();
-    BBLIDDataReuseSegment allidset;
+    // no reuse segment is considered until it is added to the batch
+    IncrementalCost engine(&_cost_index, decision, false);
     int cur_node = 0;
     int leaves_size = _bbl_data_reuse.getLeaves().size();
 
@@ -626,38 +1285,33 @@ DECISION CostSolver::Debug_StartFromUnimportantSegment(std::ostream &ofs)
         if (seg.getCount() * reuse_max < _batch_threshold * elapsed_time_min) break;
         cur_node++;
     }
+    cur_node = std::min(cur_node, leaves_size - 1);
 
     for (; cur_node >= 0; --cur_node) {
         BBLIDDataReuseSegment seg;
         _bbl_data_reuse.ExportSegment(&seg, _bbl_data_reuse.getLeaves()[cur_node]);
-        _bbl_data_reuse.UpdateTrie(partial_root, &seg);
+        engine.ActivateLeaf(cur_node);
         std::vector<BBLID> cur_batch(seg.begin(), seg.end());
         std::cout << "cur_node = " << cur_node << ", size = " << seg.size() << std::endl;
 
         // ignore too long segments
         if ((int)seg.size() >= _batch_size) continue;
 
-        cur_total = PermuteDecision(decision, cur_batch, partial_root);
+        cur_total = PermuteDecision(engine, cur_batch);
         
         for (auto elem : cur_batch) {
-            std::cout << elem << getCostSiteString(decision[elem]) << " ";
+            std::cout << elem << getCostSiteString(engine.site(elem)) << " ";
         }
 
-        std::cout << "seg_count = " << seg.getCount() << ", reuse_max = " << reuse_max << ", cur_total = " << cur_total << std::endl;
+        std::cout << "seg_count = " << seg.getCount() << ", reuse_max = " << CostToNs(reuse_max) << ", cur_total = " << CostToNs(cur_total) << std::endl;
         std::cout << std::endl;
     }
-
-    _bbl_data_reuse.DeleteTrie(partial_root);
-
-    const std::vector<ThreadRunStats *> *sorted = getBBLSortedStats();
+    decision = engine.decision();
 
     // assign decision for BBLs that did not occur in the reuse chains
-    for (BBLID i = 0; i < (BBLID)sorted[CPU].size(); ++i) {
-        auto *cpustats = sorted[CPU][i];
-        auto *pimstats = sorted[PIM][i];
-
+    for (BBLID i = 0; i < (BBLID)_model.size(); ++i) {
         if (decision[i] == INVALID) {
-            if (cpustats->MaxElapsedTime() <= pimstats->MaxElapsedTime()) {
+            if (_model._time[CPU][i] <= _model._time[PIM][i]) {
                 decision[i] = CPU;
             }
             else {
@@ -666,33 +1320,97 @@ DECISION CostSolver::Debug_StartFromUnimportantSegment(std::ostream &ofs)
         }
     }
 
-    cur_total = Cost(decision, _bbl_data_reuse.getRoot(), _bbl_switch_count);
-    std::cout << "cur_total = " << cur_total << std::endl;
     // iterate over the remaining BBs until convergence
-    for (int j = 0; j < 2; j++) {
-        for (BBLID id = 0; id < (BBLID)sorted[CPU].size(); id++) {
-            // swap decision[id] and check if it reduces overhead
-            decision[id] = (decision[id] == CPU ? PIM : CPU);
-            COST temp_total = Cost(decision, _bbl_data_reuse.getRoot(), _bbl_switch_count);
-            if (temp_total > cur_total) {
-                decision[id] = (decision[id] == CPU ? PIM : CPU);
-            }
-            else {
-                cur_total = temp_total;
-            }
+    cur_total = SingleFlipSearch(decision, 2);
+
+    PrintCostLine(ofs, "Reuse", decision);
+
+    return decision;
+}
+
+// Partition the BBLs into blocks of at most _batch_size BBLs, where reuse segments are
+// hyperedges weighted by count * SingleSegMaxReuseCost() and switches are edges weighted
+// by count * switch cost. Blocks are ordered by ascending weight of the hyperedges
+// inside them, so that the most important blocks are decided last, like the leaves of PrintReuseStats.
+std::vector<std::vector<BBLID>> CostSolver::BuildHypergraphBlocks()
+{
+    const CostIndex &index = _cost_index;
+    Hypergraph graph(index._size);
+    COST reuse_max = SingleSegMaxReuseCost();
+    COST switch_max = std::max(_switch_cost[CPU], _switch_cost[PIM]);
+    for (uint32_t leaf = 0; leaf < index.LeafCount(); ++leaf) {
+        std::vector<BBLID> pins(index._leaf_member.begin() + index._leaf_begin[leaf], index._leaf_member.begin() + index._leaf_begin[leaf + 1]);
+        graph.AddEdge(pins, (double)index._leaf_count[leaf] * reuse_max);
+    }
+    for (uint32_t e = 0; e < index.EdgeCount(); ++e) {
+        if (index._edge_from[e] == index._edge_to[e]) continue;
+        graph.AddEdge({ index._edge_from[e], index._edge_to[e] }, (double)index._edge_count[e] * switch_max);
+    }
+    graph.Finalize();
+
+    HypergraphPartitioner partitioner(&graph, _batch_size);
+    std::vector<BBLID> block = partitioner.Partition();
+
+    BBLID block_num = 0;
+    for (auto b : block) {
+        block_num = std::max(block_num, b + 1);
+    }
+    std::vector<std::vector<BBLID>> blocks(block_num);
+    for (BBLID i = 0; i < index._size; ++i) {
+        blocks[block[i]].push_back(i);
+    }
+
+    std::vector<double> weight(block_num, 0);
+    double total_weight = 0;
+    for (uint32_t e = 0; e < graph.EdgeCount(); ++e) {
+        total_weight += graph._weight[e];
+        BBLID b = block[graph._pin[graph._edge_begin[e]]];
+        bool inside = true;
+        for (uint32_t p = graph._edge_begin[e]; p < graph._edge_begin[e + 1]; ++p) {
+            inside = inside && (block[graph._pin[p]] == b);
         }
-        std::cout << "cur_total = " << cur_total << std::endl;
+        if (inside) weight[b] += graph._weight[e];
+    }
+    std::vector<BBLID> order(block_num);
+    for (BBLID b = 0; b < block_num; ++b) {
+        order[b] = b;
     }
+    std::stable_sort(order.begin(), order.end(), [&](BBLID l, BBLID r) { return weight[l] < weight[r]; });
 
-    COST reuse_cost = ReuseCost(decision, _bbl_data_reuse.getRoot());
-    COST switch_cost = SwitchCost(decision, _bbl_switch_count);
-    auto elapsed_time = ElapsedTime(decision);
-    COST total_time = reuse_cost + switch_cost + elapsed_time.first + elapsed_time.second;
-    assert(total_time == Cost(decision, _bbl_data_reuse.getRoot(), _bbl_switch_count));
+    std::vector<std::vector<BBLID>> result;
+    size_t largest = 0;
+    for (auto b : order) {
+        largest = std::max(largest, blocks[b].size());
+        result.push_back(std::move(blocks[b]));
+    }
+    std::cout << "blocks = " << block_num << ", largest = " << largest
+              << ", cut weight = " << (total_weight > 0 ? graph.CutWeight(block) / total_weight * 100 : 0) << "%" << std::endl;
+    return result;
+}
 
-    ofs << "Reuse offloading time (ns): " << total_time << " = CPU " << elapsed_time.first << " + PIM " << elapsed_time.second << " + REUSE " << reuse_cost << " + SWITCH " << switch_cost << std::endl;
+// search each block exhaustively in turn,
+// a reuse segment is considered once all its members are in searched blocks
+COST CostSolver::PermuteBlocks(IncrementalCost &engine, const std::vector<std::vector<BBLID>> &blocks)
+{
+    const CostIndex &index = _cost_index;
+    std::vector<uint32_t> unsearched(index.LeafCount());
+    for (uint32_t leaf = 0; leaf < index.LeafCount(); ++leaf) {
+        unsearched[leaf] = index.LeafSize(leaf);
+    }
 
-    return decision;
+    COST cur_total = engine.Cost();
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        if (_checkpoint.Stopped()) break;
+        for (auto elem : blocks[b]) {
+            for (uint32_t i = index._bbl_leaf_begin[elem]; i < index._bbl_leaf_begin[elem + 1]; ++i) {
+                uint32_t leaf = index._bbl_leaf[i];
+                if (--unsearched[leaf] == 0) engine.ActivateLeaf(leaf);
+            }
+        }
+        cur_total = PermuteDecision(engine, blocks[b]);
+        std::cout << "cur_block = " << b << ", size = " << blocks[b].size() << ", cur_total = " << CostToNs(cur_total) << std::endl;
+    }
+    return cur_total;
 }
 
 DECISION CostSolver::PrintReuseStats(std::ostream &ofs)
@@ -707,85 +1425,90 @@ DECISION CostSolver::PrintReuseStats(std::ostream &ofs)
     COST elapsed_time_min = (ElapsedTime(CPU) < ElapsedTime(PIM) ? ElapsedTime(CPU) : ElapsedTime(PIM));
     COST reuse_max = SingleSegMaxReuseCost();
 
-    COST min_total = FLT_MAX;
-    DECISION min_decision, decision;
+    bool hypergraph = (_command_line_parser->batchformer() == CommandLineParser::BatchFormer::HYPERGRAPH);
+    std::vector<std::vector<BBLID>> blocks;
+    if (hypergraph) blocks = BuildHypergraphBlocks();
+
+    COST min_total = MAX_COST;
+    DECISION decision;
+    DECISION min_decision;
     std::vector<CostSite> init_decisions = {CPU, PIM, INVALID};
     for (auto init_decision : init_decisions) {
         decision.clear();
         decision.resize(_bbl_hash2stats[CPU].size(), init_decision);
-        COST cur_total = FLT_MAX;
-
-        BBLIDTrieNode *partial_root = new BBLIDTrieNode();
-        BBLIDDataReuseSegment allidset;
-        int cur_node = 0;
-        int leaves_size = _bbl_data_reuse.getLeaves().size();
+        COST cur_total = MAX_COST;
 
-        // find out the node with smallest importance but exceeds the threshold, skip the rest
-        while (cur_node < leaves_size) {
-            BBLIDDataReuseSegment seg;
-            _bbl_data_reuse.ExportSegment(&seg, _bbl_data_reuse.getLeaves()[cur_node]);
-            if (seg.getCount() * reuse_max < _batch_threshold * elapsed_time_min) break;
-            cur_node++;
+        // no reuse segment is considered until it is added to the batch
+        IncrementalCost engine(&_cost_index, decision, false);
+        if (hypergraph) {
+            cur_total = PermuteBlocks(engine, blocks);
         }
-
-        for (; cur_node >= 0; --cur_node) {
-            BBLIDDataReuseSegment seg;
-            _bbl_data_reuse.ExportSegment(&seg, _bbl_data_reuse.getLeaves()[cur_node]);
-            _bbl_data_reuse.UpdateTrie(partial_root, &seg);
-
-            // ignore too long segments
-            if ((int)seg.size() >= _batch_size) continue;
-
-            // find BBLs with most occurence in all switching points related to BBLs in current segment
-            std::unordered_map<BBLID, uint64_t> total_switch_cnt_map;
-            for (auto fromidx : seg) {
-                SwitchCountList::SwitchCountRow &row = _bbl_switch_count.getRow(fromidx);
-                for (auto elem : row) {
-                    BBLID toidx = elem.first;
-                    uint64_t count = elem.second;
-                    auto it = total_switch_cnt_map.find(toidx);
-                    if (it != total_switch_cnt_map.end()) {
-                        it->second += count;
-                    }
-                    else {
-                        total_switch_cnt_map[toidx] = count;
+        else {
+            int cur_node = 0;
+            int leaves_size = _bbl_data_reuse.getLeaves().size();
+
+            // find out the node with smallest importance but exceeds the threshold, skip the rest
+            while (cur_node < leaves_size) {
+                BBLIDDataReuseSegment seg;
+                _bbl_data_reuse.ExportSegment(&seg, _bbl_data_reuse.getLeaves()[cur_node]);
+                if (seg.getCount() * reuse_max < _batch_threshold * elapsed_time_min) break;
+                cur_node++;
+            }
+            cur_node = std::min(cur_node, leaves_size - 1);
+
+            for (; cur_node >= 0; --cur_node) {
+                if (_checkpoint.Stopped()) break;
+                BBLIDDataReuseSegment seg;
+                _bbl_data_reuse.ExportSegment(&seg, _bbl_data_reuse.getLeaves()[cur_node]);
+                engine.ActivateLeaf(cur_node);
+
+                // ignore too long segments
+                if ((int)seg.size() >= _batch_size) continue;
+
+                // find BBLs with most occurence in all switching points related to BBLs in current segment
+                std::unordered_map<BBLID, uint64_t> total_switch_cnt_map;
+                for (auto fromidx : seg) {
+                    for (uint32_t e = _bbl_flat_switch.RowBegin(fromidx); e < _bbl_flat_switch.RowEnd(fromidx); ++e) {
+                        BBLID toidx = _bbl_flat_switch._toidx[e];
+                        uint64_t count = _bbl_flat_switch.count(e);
+                        auto it = total_switch_cnt_map.find(toidx);
+                        if (it != total_switch_cnt_map.end()) {
+                            it->second += count;
+                        }
+                        else {
+                            total_switch_cnt_map[toidx] = count;
+                        }
                     }
                 }
-            }
-            std::vector<std::pair<BBLID, uint64_t>> total_switch_cnt_vec(total_switch_cnt_map.begin(), total_switch_cnt_map.end());
-            std::sort(total_switch_cnt_vec.begin(), total_switch_cnt_vec.end(),
-                [](auto l, auto r){ return l.second > r.second; });
+                std::vector<std::pair<BBLID, uint64_t>> total_switch_cnt_vec(total_switch_cnt_map.begin(), total_switch_cnt_map.end());
+                std::sort(total_switch_cnt_vec.begin(), total_switch_cnt_vec.end(),
+                    [](auto l, auto r){ return l.second > r.second; });
 
-            for (auto elem : total_switch_cnt_vec) {
-                if ((int)seg.size() >= _batch_size) break;
-                seg.insert(elem.first);
-            }
+                for (auto elem : total_switch_cnt_vec) {
+                    if ((int)seg.size() >= _batch_size) break;
+                    seg.insert(elem.first);
+                }
 
-            std::vector<BBLID> cur_batch(seg.begin(), seg.end());
-            std::cout << "cur_node = " << cur_node << ", size = " << seg.size() << std::endl;
+                std::vector<BBLID> cur_batch(seg.begin(), seg.end());
+                std::cout << "cur_node = " << cur_node << ", size = " << seg.size() << std::endl;
 
-            cur_total = PermuteDecision(decision, cur_batch, partial_root);
+                cur_total = PermuteDecision(engine, cur_batch);
             
-            for (auto elem : cur_batch) {
-                std::cout << elem << getCostSiteString(decision[elem]) << " ";
-            }
+                for (auto elem : cur_batch) {
+                    std::cout << elem << getCostSiteString(engine.site(elem)) << " ";
+                }
      
 
-            std::cout << "seg_count = " << seg.getCount() << ", reuse_max = " << reuse_max << ", cur_total = " << cur_total << std::endl;
-            std::cout << std::endl;
+                std::cout << "seg_count = " << seg.getCount() << ", reuse_max = " << CostToNs(reuse_max) << ", cur_total = " << CostToNs(cur_total) << std::endl;
+                std::cout << std::endl;
+            }
         }
-
-        _bbl_data_reuse.DeleteTrie(partial_root);
-
-        const std::vector<ThreadRunStats *> *sorted = getBBLSortedStats();
+        decision = engine.decision();
 
         // assign decision for BBLs that did not occur in the reuse chains
-        for (BBLID i = 0; i < (BBLID)sorted[CPU].size(); ++i) {
-            auto *cpustats = sorted[CPU][i];
-            auto *pimstats = sorted[PIM][i];
-
+        for (BBLID i = 0; i < (BBLID)_model.size(); ++i) {
             if (decision[i] == INVALID) {
-                if (cpustats->MaxElapsedTime() <= pimstats->MaxElapsedTime()) {
+                if (_model._time[CPU][i] <= _model._time[PIM][i]) {
                     decision[i] = CPU;
                 }
                 else {
@@ -794,44 +1517,716 @@ DECISION CostSolver::PrintReuseStats(std::ostream &ofs)
             }
         }
 
-        cur_total = Cost(decision, _bbl_data_reuse.getRoot(), _bbl_switch_count);
-        std::cout << "cur_total = " << cur_total << std::endl;
         // iterate over the remaining BBs until convergence
-        for (int j = 0; j < 2; j++) {
-            for (BBLID id = 0; id < (BBLID)sorted[CPU].size(); id++) {
-                // swap decision[id] and check if it reduces overhead
-                decision[id] = (decision[id] == CPU ? PIM : CPU);
-                COST temp_total = Cost(decision, _bbl_data_reuse.getRoot(), _bbl_switch_count);
-                if (temp_total > cur_total) {
-                    decision[id] = (decision[id] == CPU ? PIM : CPU);
-                }
-                else {
-                    cur_total = temp_total;
-                }
-            }
-            std::cout << "cur_total = " << cur_total << std::endl;
-        }
+        cur_total = SingleFlipSearch(decision, 2);
+        _checkpoint.Offer(decision, cur_total);
         if (min_total > cur_total) {
             min_decision = decision;
             min_total = cur_total;
-            std::cout << min_total << std::endl;
+            std::cout << CostToNs(min_total) << std::endl;
         }
+        if (_checkpoint.Stopped()) break;
     }
 
-    COST reuse_cost = ReuseCost(min_decision, _bbl_data_reuse.getRoot());
-    COST switch_cost = SwitchCost(min_decision, _bbl_switch_count);
-    auto elapsed_time = ElapsedTime(min_decision);
-    COST total_time = reuse_cost + switch_cost + elapsed_time.first + elapsed_time.second;
-
-    ofs << "Reuse offloading time (ns): " << total_time << " = CPU " << elapsed_time.first << " + PIM " << elapsed_time.second << " + REUSE " << reuse_cost << " + SWITCH " << switch_cost << std::endl;
+    decision = min_decision;
+    PrintCostLine(ofs, "Reuse", decision);
 
 
     // std::ofstream oo(
     //     (_command_line_parser->outputfile() + ".debug").c_str(),
     //     std::ofstream::out);
-    // _bbl_switch_count.printSwitch(oo, decision, _switch_cost);
+    // _bbl_flat_switch.printSwitch(oo, decision, _switch_cost);
+
+    return decision;
+}
+
+// Every term of the cost is representable by a graph cut, so the minimum cut
+// is an optimal decision. BBLs on the source side of the cut are on CPU, and
+// BBLs on the sink side are on PIM. A cut edge u->v costs when u is on CPU and v is on PIM.
+//     elapsed time: source->i with the PIM time, i->sink with the CPU time;
+//     switch f->t: f->t with the switch cost from CPU, t->f with the switch cost from PIM;
+//     reuse segment with head h: it costs A if h is on CPU and any member is on PIM,
+//     which is h->z with A and z->i with infinity for an auxiliary node z;
+//     it costs B if h is on PIM and any member is on CPU,
+//     which is w->h with B and i->w with infinity for an auxiliary node w.
+// The cost of the decision, i.e., the flow, is stored to flow if given.
+// penalty[e], if given, is added to switch edge e in both directions.
+DECISION CostSolver::MinCut(const CostIndex &index, COST *flow, const std::vector<COST> *penalty)
+{
+    BBLID size = index._size;
+    MaxFlowGraph<COST> graph(size + 2);
+    uint32_t source = size, sink = size + 1;
+
+    // an infinite capacity only has to exceed the total of the finite ones
+    COST infinity = 1;
+    for (BBLID i = 0; i < size; ++i) {
+        graph.AddEdge(source, i, index._elapsed[PIM][i]);
+        graph.AddEdge(i, sink, index._elapsed[CPU][i]);
+        infinity += index._elapsed[PIM][i] + index._elapsed[CPU][i];
+    }
+    for (uint32_t e = 0; e < index.EdgeCount(); ++e) {
+        BBLID from = index._edge_from[e], to = index._edge_to[e];
+        COST extra = (penalty != nullptr ? (*penalty)[e] : 0);
+        COST cpu2pim = index._switch_cost[CPU] * index._edge_count[e] + extra;
+        COST pim2cpu = index._switch_cost[PIM] * index._edge_count[e] + extra;
+        graph.AddEdge(from, to, cpu2pim);
+        graph.AddEdge(to, from, pim2cpu);
+        infinity += cpu2pim + pim2cpu;
+    }
+    for (uint32_t leaf = 0; leaf < index.LeafCount(); ++leaf) {
+        infinity += index._leaf_count[leaf] * (index._mixed_cost[CPU] + index._mixed_cost[PIM]);
+    }
+    for (uint32_t leaf = 0; leaf < index.LeafCount(); ++leaf) {
+        if (index.LeafSize(leaf) <= 1) continue;
+        BBLID head = index._leaf_head[leaf];
+        uint32_t z = graph.AddNode();
+        uint32_t w = graph.AddNode();
+        graph.AddEdge(head, z, index._leaf_count[leaf] * index._mixed_cost[CPU]);
+        graph.AddEdge(w, head, index._leaf_count[leaf] * index._mixed_cost[PIM]);
+        for (uint32_t m = index._leaf_begin[leaf]; m < index._leaf_begin[leaf + 1]; ++m) {
+            BBLID member = index._leaf_member[m];
+            if (member == head) continue;
+            graph.AddEdge(z, member, infinity);
+            graph.AddEdge(member, w, infinity);
+        }
+    }
+
+    COST mincut = graph.MaxFlow(source, sink);
+    if (flow != nullptr) *flow = mincut;
+
+    DECISION decision(size);
+    for (BBLID i = 0; i < size; ++i) {
+        decision[i] = (graph.OnSourceSide(i) ? CPU : PIM);
+    }
+    return decision;
+}
+
+// the cost of the cut, which is the optimal cost, is stored to optimum if given
+DECISION CostSolver::PrintMinCutStats(std::ostream &ofs, COST *optimum)
+{
+    COST flow;
+    DECISION decision = FromSearch(MinCut(*_search_index, &flow));
+    std::cout << "min cut = " << CostToNs(flow + SearchOffset()) << std::endl;
+    if (optimum != nullptr) *optimum = flow + SearchOffset();
+
+    PrintCostLine(ofs, "MinCut", decision);
+
+    return decision;
+}
+
+// The sum of the min cuts of the connected components of whole is the optimal cost,
+// so this "bound" is tight: it costs a full exact solve. It is a real relaxation only
+// when whole is one, as for overlap mode. The components are cut in parallel.
+COST CostSolver::LowerBound(const CostIndex &whole)
+{
+    std::vector<std::vector<BBLID>> components = BuildComponents(whole);
+    std::vector<BBLID> local(whole._size);
+    for (auto &component : components) {
+        for (BBLID i = 0; i < (BBLID)component.size(); ++i) {
+            local[component[i]] = i;
+        }
+    }
+
+    std::vector<COST> bound(components.size(), 0);
+    _thread_pool->ParallelFor(components.size(), [&](int, size_t c) {
+        const std::vector<BBLID> &component = components[c];
+        if (component.size() == 1) {
+            BBLID bblid = component[0];
+            bound[c] = std::min(whole._elapsed[CPU][bblid], whole._elapsed[PIM][bblid]);
+            return;
+        }
+        CostIndex index;
+        index.initialize(whole, component, local);
+        MinCut(index, &bound[c]);
+    });
+
+    // summed in component order, so the bound does not depend on the thread count
+    COST total = 0;
+    for (auto elem : bound) {
+        total += elem;
+    }
+    return total;
+}
+
+// BBLs of the same function that are joined by switch edges form one window,
+// where the CPU and PIM parts may run concurrently. The function is the upper half
+// of the BBL hash, as in multilevel mode. Windows are numbered by their smallest BBLID.
+void CostSolver::BuildOverlapWindows()
+{
+    const CostIndex &index = _cost_index;
+    DisjointSet ds(index._size);
+    for (uint32_t e = 0; e < index.EdgeCount(); ++e) {
+        BBLID f = index._edge_from[e], t = index._edge_to[e];
+        if (_model._bblhash[f].first == _model._bblhash[t].first) ds.Union(f, t);
+    }
+
+    std::vector<BBLID> window_of(index._size, -1);
+    _overlap_window.assign(index._size, 0);
+    _overlap_windows = 0;
+    for (BBLID i = 0; i < index._size; ++i) {
+        BBLID root = ds.Find(i);
+        if (window_of[root] < 0) window_of[root] = _overlap_windows++;
+        _overlap_window[i] = window_of[root];
+    }
+}
+
+COST CostSolver::OverlapTotal(const DECISION &decision)
+{
+    PIMProf::OverlapCost engine(&_cost_index, &_overlap_window, _overlap_windows, decision);
+    return engine.Cost();
+}
+
+// max(CPU, PIM) >= (CPU + PIM) / 2, so halving the elapsed time of every BBL that shares
+// its window gives a serialized problem whose min cut bounds the overlap cost from below
+CostIndex CostSolver::OverlapRelaxation()
+{
+    std::vector<BBLID> window_size(_overlap_windows, 0);
+    for (BBLID i = 0; i < _cost_index._size; ++i) {
+        window_size[_overlap_window[i]]++;
+    }
+    CostIndex relaxed = _cost_index;
+    for (BBLID i = 0; i < relaxed._size; ++i) {
+        if (window_size[_overlap_window[i]] == 1) continue;
+        for (int s = 0; s < MAX_COST_SITE; ++s) {
+            relaxed._elapsed[s][i] /= 2;
+        }
+    }
+    return relaxed;
+}
+
+// Local search on the overlap cost from each initial decision: single BBL flips,
+// then moves of whole reuse segments to one site, until neither improves.
+DECISION CostSolver::PrintOverlapStats(std::ostream &ofs, const std::vector<DECISION> &initial)
+{
+    static const int MAX_PASSES = 64;
+    const CostIndex &index = _cost_index;
+
+    DECISION decision;
+    COST best = MAX_COST;
+    std::vector<CostSite> saved;
+    for (auto &start : initial) {
+        PIMProf::OverlapCost engine(&index, &_overlap_window, _overlap_windows, start);
+        for (int pass = 0; pass < MAX_PASSES && !_checkpoint.Stopped(); ++pass) {
+            bool improved = false;
+            for (BBLID i = 0; i < index._size; ++i) {
+                CostSite other = (engine.site(i) == CPU ? PIM : CPU);
+                if (engine.Delta(i, other) < 0) {
+                    engine.Assign(i, other);
+                    improved = true;
+                }
+            }
+            for (uint32_t leaf = 0; leaf < index.LeafCount(); ++leaf) {
+                if (index.LeafSize(leaf) <= 1) continue;
+                for (int s = 0; s < MAX_COST_SITE; ++s) {
+                    COST before = engine.Cost();
+                    saved.clear();
+                    for (uint32_t m = index._leaf_begin[leaf]; m < index._leaf_begin[leaf + 1]; ++m) {
+                        saved.push_back(engine.site(index._leaf_member[m]));
+                        engine.Assign(index._leaf_member[m], (CostSite)s);
+                    }
+                    if (engine.Cost() < before) {
+                        improved = true;
+                        continue;
+                    }
+                    for (uint32_t m = index._leaf_begin[leaf]; m < index._leaf_begin[leaf + 1]; ++m) {
+                        engine.Assign(index._leaf_member[m], saved[m - index._leaf_begin[leaf]]);
+                    }
+                }
+            }
+            _checkpoint.Offer(engine.decision(), engine.Cost());
+            if (!improved) break;
+        }
+        if (engine.Cost() < best) {
+            best = engine.Cost();
+            decision = engine.decision();
+        }
+    }
+
+    PIMProf::OverlapCost engine(&index, &_overlap_window, _overlap_windows, decision);
+    std::cout << "serialized = " << CostToNs(Cost(decision)) << std::endl;
+    ofs << "Overlap offloading time (ns): " << CostToNs(engine.Cost()) << " = OVERLAP " << CostToNs(engine.WindowTime()) << " + REUSE " << CostToNs(engine.ReuseCost()) << " + SWITCH " << CostToNs(engine.SwitchCost()) << std::endl;
+
+    return decision;
+}
+
+// The PIM core time of a BBL is its elapsed time summed over the threads of the PIM run,
+// and its memory accesses are those of the PIM run.
+void CostSolver::BuildCapacityBudget()
+{
+    BBLID size = _model.size();
+    _capacity.initialize(size);
+
+    if (_command_line_parser->pimcoretime() >= 0) {
+        std::vector<double> weight(size);
+        for (BBLID i = 0; i < size; ++i) {
+            weight[i] = CostToNs(_model._core_time[PIM][i]);
+        }
+        _capacity.AddBudget("PIM core time (ns)", weight, _command_line_parser->pimcoretime());
+    }
+    if (_command_line_parser->pimmemoryfraction() >= 0) {
+        std::vector<double> weight(size);
+        double total = 0;
+        for (BBLID i = 0; i < size; ++i) {
+            weight[i] = _model._mem[PIM][i];
+            total += weight[i];
+        }
+        _capacity.AddBudget("PIM memory accesses", weight, _command_line_parser->pimmemoryfraction() * total);
+    }
+    if (_command_line_parser->pimparallelism() >= 0) {
+        for (BBLID i = 0; i < size; ++i) {
+            if (_model._parallelism[PIM][i] > _command_line_parser->pimparallelism()) _capacity.Forbid(i);
+        }
+    }
+}
+
+// Moves BBLs from PIM to CPU until all budgets hold, forbidden BBLs first,
+// then in ascending order of cost increase per normalized weight.
+DECISION CostSolver::RepairCapacity(const DECISION &decision)
+{
+    const CapacityBudget &budget = _capacity;
+    IncrementalCost engine(&_cost_index, decision);
+    std::vector<std::pair<double, BBLID>> order;
+    for (BBLID i = 0; i < (BBLID)decision.size(); ++i) {
+        if (decision[i] != PIM) continue;
+        if (budget.forbidden(i)) {
+            engine.Assign(i, CPU);
+            continue;
+        }
+        double weight = budget.NormalizedWeight(i);
+        if (weight > 0) order.push_back(std::make_pair(CostToNs(engine.Delta(i, CPU)) / weight, i));
+    }
+    std::sort(order.begin(), order.end());
+    for (auto &elem : order) {
+        if (budget.Feasible(engine.decision())) break;
+        engine.Assign(elem.second, CPU);
+    }
+    return engine.decision();
+}
+
+// Lagrangian relaxation of the budgets: a BBL on PIM pays lambda times its normalized weight,
+// and each lambda is solved by one min cut. Lambda is doubled until the cut is feasible and
+// then bisected, every cut raises bound to cut - lambda * Active() if that is higher.
+// The best feasible cut and the repaired last infeasible one are improved by feasible flips.
+DECISION CostSolver::PrintCapacityStats(std::ostream &ofs, COST &bound)
+{
+    static const int MAX_DOUBLINGS = 64;
+    static const int BISECTIONS = 32;
+    static const int MAX_PASSES = 64;
+
+    const CapacityBudget &budget = _capacity;
+    BBLID size = _cost_index._size;
+    // a PIM BBL that costs more than all CPU is never in the cut
+    COST allcpu = Cost(DECISION(size, CPU));
+
+    CostIndex priced = _cost_index;
+    std::vector<DECISION> candidates;
+    DECISION infeasible;
+    auto solve = [&](double lambda) {
+        for (BBLID i = 0; i < size; ++i) {
+            double extra = lambda * budget.NormalizedWeight(i);
+            priced._elapsed[PIM][i] = (budget.forbidden(i) || extra >= CostToNs(allcpu) ?
+                allcpu + 1 : _cost_index._elapsed[PIM][i] + NsToCost(extra));
+        }
+        COST flow;
+        DECISION decision = MinCut(priced, &flow);
+        bound = std::max(bound, flow - NsToCost(std::ceil(lambda * budget.Active())));
+        bool feasible = budget.Feasible(decision);
+        if (feasible) candidates.push_back(decision);
+        else infeasible = decision;
+        return feasible;
+    };
+
+    double low = 0, high = CostToNs(allcpu) / std::max<size_t>(budget.Active(), 1);
+    double lambda = 0;
+    int cuts = 1;
+    if (!solve(0)) {
+        while (cuts <= MAX_DOUBLINGS && !solve(high)) {
+            low = high;
+            high *= 2;
+            cuts++;
+        }
+        for (int i = 0; i < BISECTIONS && !_checkpoint.Stopped(); ++i, ++cuts) {
+            double mid = (low + high) / 2;
+            if (solve(mid)) high = mid;
+            else low = mid;
+        }
+        candidates.push_back(RepairCapacity(infeasible));
+        lambda = high;
+    }
+    std::cout << "capacity cuts = " << cuts << ", lambda = " << lambda << std::endl;
+
+    DECISION decision(size, CPU);
+    COST best = allcpu;
+    for (auto &start : candidates) {
+        IncrementalCost engine(&_cost_index, start);
+        std::vector<double> usage = budget.Usage(start);
+        for (int pass = 0; pass < MAX_PASSES && !_checkpoint.Stopped(); ++pass) {
+            bool improved = false;
+            for (BBLID i = 0; i < size; ++i) {
+                if (engine.site(i) == PIM && engine.FlipGain(i) > 0) {
+                    engine.Flip(i);
+                    for (size_t k = 0; k < budget.size(); ++k) {
+                        usage[k] -= budget._weight[k][i];
+                    }
+                    improved = true;
+                }
+                else if (engine.site(i) == CPU && engine.FlipGain(i) > 0 && budget.Fits(usage, i)) {
+                    engine.Flip(i);
+                    for (size_t k = 0; k < budget.size(); ++k) {
+                        usage[k] += budget._weight[k][i];
+                    }
+                    improved = true;
+                }
+            }
+            if (!improved) break;
+        }
+        assert(budget.Feasible(engine.decision()));
+        _checkpoint.Offer(engine.decision(), engine.Cost());
+        if (engine.Cost() < best) {
+            best = engine.Cost();
+            decision = engine.decision();
+        }
+    }
+
+    PrintCostLine(ofs, "Capacity", decision);
+    std::vector<double> usage = budget.Usage(decision);
+    for (size_t k = 0; k < budget.size(); ++k) {
+        ofs << budget._name[k] << ": " << usage[k] << " of " << budget._limit[k] << std::endl;
+    }
+
+    return decision;
+}
+
+// -R, or no cap if it is not given
+BBLID CostSolver::MaxRegions()
+{
+    BBLID max_regions = _command_line_parser->maxregions();
+    return (max_regions < 0 ? (BBLID)_cost_index._size : max_regions);
+}
+
+// A region is a connected set of PIM BBLs in the switch graph, where edges are undirected.
+BBLID CostSolver::CountRegions(const DECISION &decision)
+{
+    const CostIndex &index = _cost_index;
+    DisjointSet ds(index._size);
+    BBLID regions = 0;
+    for (BBLID i = 0; i < index._size; ++i) {
+        if (decision[i] == PIM) regions++;
+    }
+    for (uint32_t e = 0; e < index.EdgeCount(); ++e) {
+        BBLID f = index._edge_from[e], t = index._edge_to[e];
+        if (decision[f] != PIM || decision[t] != PIM) continue;
+        if (ds.Find(f) != ds.Find(t)) {
+            ds.Union(f, t);
+            regions--;
+        }
+    }
+    return regions;
+}
+
+// Moves the region that is cheapest to move to CPU, until at most max_regions are left.
+DECISION CostSolver::RepairRegions(const DECISION &decision, BBLID max_regions)
+{
+    const CostIndex &index = _cost_index;
+    IncrementalCost engine(&index, decision);
+    std::vector<BBLID> members;
+    while (CountRegions(engine.decision()) > max_regions) {
+        DisjointSet ds(index._size);
+        for (uint32_t e = 0; e < index.EdgeCount(); ++e) {
+            BBLID f = index._edge_from[e], t = index._edge_to[e];
+            if (engine.site(f) == PIM && engine.site(t) == PIM) ds.Union(f, t);
+        }
+        std::vector<std::vector<BBLID>> region(index._size);
+        for (BBLID i = 0; i < index._size; ++i) {
+            if (engine.site(i) == PIM) region[ds.Find(i)].push_back(i);
+        }
+
+        COST before = engine.Cost();
+        COST best = MAX_COST;
+        BBLID best_root = -1;
+        for (BBLID root = 0; root < index._size; ++root) {
+            if (region[root].empty()) continue;
+            for (BBLID i : region[root]) {
+                engine.Assign(i, CPU);
+            }
+            if (engine.Cost() - before < best) {
+                best = engine.Cost() - before;
+                best_root = root;
+            }
+            for (BBLID i : region[root]) {
+                engine.Assign(i, PIM);
+            }
+        }
+        for (BBLID i : region[best_root]) {
+            engine.Assign(i, CPU);
+        }
+    }
+    return engine.decision();
+}
 
-    return min_decision;
+// The number of regions is at least the number of PIM BBLs minus the number of pairs of
+// PIM BBLs joined by a switch edge, with equality on a forest. Its Lagrangian, mu per PIM BBL
+// minus mu per such pair, is representable by a cut:
+//     -mu [u and v on PIM] = -mu / 2 [u on PIM] - mu / 2 [v on PIM] + mu / 2 [u, v on different sites],
+// so every BBL on PIM pays mu (1 - degree / 2) and every pair pays mu / 2 when it is cut.
+// Mu is doubled until the cut has at most -R regions and then bisected, every cut raises
+// bound to cut - mu * R if that is higher. The best fitting cut, and the repaired cuts
+// of mu = 0 and of the largest mu that does not fit, are improved by single flips that keep the cap.
+DECISION CostSolver::PrintRegionStats(std::ostream &ofs, COST &bound)
+{
+    static const int MAX_DOUBLINGS = 64;
+    static const int BISECTIONS = 32;
+    static const int MAX_PASSES = 64;
+
+    const CostIndex &index = _cost_index;
+    BBLID size = index._size;
+    BBLID max_regions = MaxRegions();
+    COST allcpu = Cost(DECISION(size, CPU));
+
+    // the first switch edge of each pair of different BBLs carries the pair
+    std::vector<char> carrier(index.EdgeCount(), false);
+    std::vector<BBLID> degree(size, 0);
+    {
+        std::vector<std::pair<BBLID, BBLID>> pairs;
+        for (uint32_t e = 0; e < index.EdgeCount(); ++e) {
+            BBLID f = index._edge_from[e], t = index._edge_to[e];
+            if (f != t) pairs.push_back(std::make_pair(std::min(f, t), std::max(f, t)));
+        }
+        std::sort(pairs.begin(), pairs.end());
+        pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+        std::vector<char> taken(pairs.size(), false);
+        for (uint32_t e = 0; e < index.EdgeCount(); ++e) {
+            BBLID f = index._edge_from[e], t = index._edge_to[e];
+            if (f == t) continue;
+            auto key = std::make_pair(std::min(f, t), std::max(f, t));
+            auto it = std::lower_bound(pairs.begin(), pairs.end(), key);
+            assert(it != pairs.end() && *it == key);
+            if (taken[it - pairs.begin()]) continue;
+            taken[it - pairs.begin()] = true;
+            carrier[e] = true;
+            degree[f]++;
+            degree[t]++;
+        }
+    }
+
+    CostIndex priced = index;
+    std::vector<COST> penalty(index.EdgeCount(), 0);
+    std::vector<DECISION> candidates;
+    std::vector<DECISION> infeasible; // the cuts with mu = 0 and mu = low
+    auto solve = [&](COST mu) {
+        COST offset = 0;
+        for (BBLID i = 0; i < size; ++i) {
+            COST cpu = index._elapsed[CPU][i];
+            COST pim = index._elapsed[PIM][i] + mu - mu / 2 * degree[i];
+            COST low = std::min<COST>(std::min(cpu, pim), 0);
+            priced._elapsed[CPU][i] = cpu - low;
+            priced._elapsed[PIM][i] = pim - low;
+            offset += low;
+        }
+        for (uint32_t e = 0; e < index.EdgeCount(); ++e) {
+            penalty[e] = (carrier[e] ? mu / 2 : 0);
+        }
+        COST flow;
+        DECISION decision = MinCut(priced, &flow, &penalty);
+        bound = std::max(bound, flow + offset - mu * max_regions);
+        if (CountRegions(decision) <= max_regions) {
+            candidates.push_back(decision);
+            return true;
+        }
+        if (infeasible.size() < 2) infeasible.push_back(decision);
+        else infeasible.back() = decision;
+        return false;
+    };
+
+    // mu is even, so that mu / 2 is exact
+    COST low = 0, high = 2 * std::max<COST>(_switch_cost[CPU], NsToCost(1));
+    COST mu = 0;
+    int cuts = 1;
+    if (!solve(0)) {
+        while (cuts <= MAX_DOUBLINGS && high <= allcpu && !solve(high)) {
+            low = high;
+            high *= 2;
+            cuts++;
+        }
+        if (high <= allcpu) {
+            for (int i = 0; i < BISECTIONS && high - low > 2 && !_checkpoint.Stopped(); ++i, ++cuts) {
+                COST mid = 2 * (COST)((low + high) / 4);
+                if (solve(mid)) high = mid;
+                else low = mid;
+            }
+            mu = high;
+        }
+        for (auto &elem : infeasible) {
+            candidates.push_back(RepairRegions(elem, max_regions));
+        }
+    }
+    std::cout << "region cuts = " << cuts << ", mu = " << CostToNs(mu) << std::endl;
+
+    DECISION decision(size, CPU);
+    COST best = allcpu;
+    for (auto &start : candidates) {
+        IncrementalCost engine(&index, start);
+        for (int pass = 0; pass < MAX_PASSES && !_checkpoint.Stopped(); ++pass) {
+            bool improved = false;
+            for (BBLID i = 0; i < size; ++i) {
+                if (engine.FlipGain(i) <= 0) continue;
+                engine.Flip(i);
+                if (CountRegions(engine.decision()) <= max_regions) improved = true;
+                else engine.Flip(i);
+            }
+            if (!improved) break;
+        }
+        _checkpoint.Offer(engine.decision(), engine.Cost());
+        if (engine.Cost() < best) {
+            best = engine.Cost();
+            decision = engine.decision();
+        }
+    }
+
+    PrintCostLine(ofs, "Region", decision);
+    ofs << "PIM regions: " << CountRegions(decision) << " of " << max_regions << std::endl;
+
+    return decision;
+}
+
+// initial holds the decisions of the other modes, which give the first upper bound
+DECISION CostSolver::PrintBranchAndBoundStats(std::ostream &ofs, const std::vector<DECISION> &initial)
+{
+    BranchAndBound bnb(_search_index);
+    bnb.SetCheckpoint(&_checkpoint);
+    for (auto &decision : initial) {
+        DECISION start = ToSearch(decision);
+        bnb.Offer(start, Cost(FromSearch(start)) - SearchOffset());
+    }
+    bool optimal = bnb.Solve(_thread_pool);
+    std::cout << "bnb " << (optimal ? "proved optimality" : "stopped early")
+              << " after " << bnb.nodes() << " nodes" << std::endl;
+
+    DECISION decision = FromSearch(bnb.best());
+    PrintCostLine(ofs, "BnB", decision, (optimal ? "" : (_checkpoint.interrupted() ? " (interrupted)" : (_checkpoint.reached() ? " (gap reached)" : " (time budget reached)"))));
+
+    return decision;
+}
+
+// temperatures from the command line, or derived from the BBLs of index if not given
+AnnealingSchedule CostSolver::MakeAnnealingSchedule(const CostIndex &index, uint64_t iterations)
+{
+    AnnealingSchedule schedule;
+    schedule._iterations = iterations;
+    schedule._start = NsToCost(_command_line_parser->starttemperature());
+    if (schedule._start <= 0) {
+        // the average gain of moving a BBL to its faster site
+        double gap = 0;
+        for (BBLID i = 0; i < index._size; ++i) {
+            gap += std::abs((double)(index._elapsed[CPU][i] - index._elapsed[PIM][i]));
+        }
+        schedule._start = (index._size > 0 && gap > 0 ? gap / index._size : NsToCost(1));
+    }
+    schedule._end = NsToCost(_command_line_parser->endtemperature());
+    if (schedule._end <= 0) {
+        schedule._end = schedule._start / 1000;
+    }
+    return schedule;
+}
+
+// Chain i starts from initial[i], then all-CPU, then all-PIM, and the remaining chains
+// start from random decisions.
+DECISION CostSolver::PrintAnnealingStats(std::ostream &ofs, const std::vector<DECISION> &initial)
+{
+    int chains = _command_line_parser->chains();
+    uint64_t seed = _command_line_parser->seed();
+
+    std::vector<DECISION> starts;
+    for (auto &decision : initial) {
+        starts.push_back(ToSearch(decision));
+    }
+    starts.push_back(ToSearch(DECISION(_cost_index._size, CPU)));
+    starts.push_back(ToSearch(DECISION(_cost_index._size, PIM)));
+
+    AnnealingSchedule schedule = MakeAnnealingSchedule(*_search_index, _command_line_parser->iterations());
+
+    std::vector<DECISION> best(chains);
+    _thread_pool->ParallelFor(chains, [&](int, size_t chain) {
+        std::mt19937_64 rng(seed + chain);
+        DECISION start;
+        if (chain < starts.size()) {
+            start = starts[chain];
+        }
+        else {
+            start.resize(_cost_index._size);
+            for (auto &elem : start) {
+                elem = ((rng() & 1) ? PIM : CPU);
+            }
+            start = ToSearch(start);
+        }
+        AnnealingChain annealing(_search_index, start, rng());
+        annealing.Run(schedule, &_checkpoint);
+        best[chain] = FromSearch(annealing.best());
+    });
+
+    // the first chain with the lowest cost wins, so the result does not depend on the thread count
+    DECISION decision;
+    COST min_total = MAX_COST;
+    for (int chain = 0; chain < chains; ++chain) {
+        COST cur_total = Cost(best[chain]);
+        std::cout << "chain " << chain << ", cur_total = " << CostToNs(cur_total) << std::endl;
+        if (cur_total < min_total) {
+            min_total = cur_total;
+            decision = best[chain];
+        }
+    }
+
+    PrintCostLine(ofs, "Anneal", decision);
+
+    return decision;
+}
+
+// The function level problem, where all BBLs of a function are on the same site,
+// is solved exactly by MinCut and projected to BBLs. Then each function with fewer
+// BBLs than the batch size is enumerated with the other BBLs fixed, followed by single flips.
+DECISION CostSolver::PrintMultilevelStats(std::ostream &ofs)
+{
+    BBL2Func(_model, _func_model, _bbl2func);
+    BBL2Func(_bbl_data_reuse, _func_data_reuse, _bbl2func);
+    BBL2Func(_bbl_flat_switch, _func_switch_count, _bbl2func);
+    _func_cost_index.initialize(_func_model._time, _func_data_reuse, _func_switch_count, _mixed_cost, _switch_cost);
+    std::cout << "functions = " << _func_model.size()
+              << ", function segments = " << _func_cost_index.LeafCount()
+              << ", function switches = " << _func_cost_index.EdgeCount() << std::endl;
+
+    COST flow;
+    DECISION funcdecision = MinCut(_func_cost_index, &flow);
+    std::cout << "min cut = " << CostToNs(flow) << std::endl;
+    DECISION decision(_model.size());
+    for (BBLID i = 0; i < (BBLID)_model.size(); ++i) {
+        decision[i] = funcdecision[_bbl2func[i]];
+    }
+
+    COST total_time = PrintCostLine(ofs, "Function", decision);
+    _checkpoint.Offer(decision, total_time);
+
+    // the BBLs of a function are adjacent
+    IncrementalCost engine(&_cost_index, decision);
+    BBLID begin = 0;
+    while (begin < (BBLID)_model.size() && !_checkpoint.Stopped()) {
+        BBLID end = begin + 1;
+        while (end < (BBLID)_model.size() && _bbl2func[end] == _bbl2func[begin]) end++;
+        if (end - begin < _batch_size) {
+            std::vector<BBLID> cur_batch;
+            for (BBLID i = begin; i < end; ++i) {
+                cur_batch.push_back(i);
+            }
+            PermuteDecision(engine, cur_batch);
+        }
+        begin = end;
+    }
+    decision = engine.decision();
+    SingleFlipSearch(decision, 2);
+
+    total_time = PrintCostLine(ofs, "Multilevel", decision);
+    _checkpoint.Offer(decision, total_time);
+
+    return decision;
 }
 
 DECISION CostSolver::Debug_HierarchicalDecision(std::ostream &ofs)
@@ -849,10 +2244,10 @@ DECISION CostSolver::Debug_HierarchicalDecision(std::ostream &ofs)
     //initialize all decision to INVALID
     DECISION decision;
     decision.resize(_bbl_hash2stats[CPU].size(), INVALID);
-    COST cur_total = FLT_MAX;
+    COST cur_total = MAX_COST;
 
-    BBLIDTrieNode *partial_root = new BBLIDTrieNode();
-    BBLIDDataReuseSegment allidset;
+    // no reuse segment is considered until it is added to the batch
+    IncrementalCost engine(&_cost_index, decision, false);
     int cur_node = 0;
     int leaves_size = _bbl_data_reuse.getLeaves().size();
 
@@ -863,11 +2258,13 @@ DECISION CostSolver::Debug_HierarchicalDecision(std::ostream &ofs)
         if (seg.getCount() * reuse_max < _batch_threshold * elapsed_time_min) break;
         cur_node++;
     }
+    cur_node = std::min(cur_node, leaves_size - 1);
 
     for (; cur_node >= 0; --cur_node) {
+        if (_checkpoint.Stopped()) break;
         BBLIDDataReuseSegment seg;
         _bbl_data_reuse.ExportSegment(&seg, _bbl_data_reuse.getLeaves()[cur_node]);
-        _bbl_data_reuse.UpdateTrie(partial_root, &seg);
+        engine.ActivateLeaf(cur_node);
 
         // ignore too long segments
         if ((int)seg.size() >= _batch_size) continue;
@@ -875,10 +2272,9 @@ DECISION CostSolver::Debug_HierarchicalDecision(std::ostream &ofs)
         // find BBLs with most occurence in all switching points related to BBLs in current segment
         std::unordered_map<BBLID, uint64_t> total_switch_cnt_map;
         for (auto fromidx : seg) {
-            SwitchCountList::SwitchCountRow &row = _bbl_switch_count.getRow(fromidx);
-            for (auto elem : row) {
-                BBLID toidx = elem.first;
-                uint64_t count = elem.second;
+            for (uint32_t e = _bbl_flat_switch.RowBegin(fromidx); e < _bbl_flat_switch.RowEnd(fromidx); ++e) {
+                BBLID toidx = _bbl_flat_switch._toidx[e];
+                uint64_t count = _bbl_flat_switch.count(e);
                 auto it = total_switch_cnt_map.find(toidx);
                 if (it != total_switch_cnt_map.end()) {
                     it->second += count;
@@ -900,28 +2296,22 @@ DECISION CostSolver::Debug_HierarchicalDecision(std::ostream &ofs)
         std::vector<BBLID> cur_batch(seg.begin(), seg.end());
         std::cout << "cur_node = " << cur_node << ", size = " << seg.size() << std::endl;
 
-        cur_total = PermuteDecision(decision, cur_batch, partial_root);
+        cur_total = PermuteDecision(engine, cur_batch);
         
         for (auto elem : cur_batch) {
-            std::cout << elem << getCostSiteString(decision[elem]) << " ";
+            std::cout << elem << getCostSiteString(engine.site(elem)) << " ";
         }
  
 
-        std::cout << "seg_count = " << seg.getCount() << ", reuse_max = " << reuse_max << ", cur_total = " << cur_total << std::endl;
+        std::cout << "seg_count = " << seg.getCount() << ", reuse_max = " << CostToNs(reuse_max) << ", cur_total = " << CostToNs(cur_total) << std::endl;
         std::cout << std::endl;
     }
-
-    _bbl_data_reuse.DeleteTrie(partial_root);
-
-    const std::vector<ThreadRunStats *> *sorted = getBBLSortedStats();
+    decision = engine.decision();
 
     // assign decision for BBLs that did not occur in the reuse chains
-    for (BBLID i = 0; i < (BBLID)sorted[CPU].size(); ++i) {
-        auto *cpustats = sorted[CPU][i];
-        auto *pimstats = sorted[PIM][i];
-
+    for (BBLID i = 0; i < (BBLID)_model.size(); ++i) {
         if (decision[i] == INVALID) {
-            if (cpustats->MaxElapsedTime() <= pimstats->MaxElapsedTime()) {
+            if (_model._time[CPU][i] <= _model._time[PIM][i]) {
                 decision[i] = CPU;
             }
             else {
@@ -930,41 +2320,92 @@ DECISION CostSolver::Debug_HierarchicalDecision(std::ostream &ofs)
         }
     }
 
-    cur_total = Cost(decision, _bbl_data_reuse.getRoot(), _bbl_switch_count);
-    std::cout << "cur_total = " << cur_total << std::endl;
     // iterate over the remaining BBs until convergence
-    for (int j = 0; j < 2; j++) {
-        for (BBLID id = 0; id < (BBLID)sorted[CPU].size(); id++) {
-            // swap decision[id] and check if it reduces overhead
-            decision[id] = (decision[id] == CPU ? PIM : CPU);
-            COST temp_total = Cost(decision, _bbl_data_reuse.getRoot(), _bbl_switch_count);
-            if (temp_total > cur_total) {
-                decision[id] = (decision[id] == CPU ? PIM : CPU);
-            }
-            else {
-                cur_total = temp_total;
-            }
-        }
-        std::cout << "cur_total = " << cur_total << std::endl;
-    }
+    cur_total = SingleFlipSearch(decision, 2);
+    _checkpoint.Offer(decision, cur_total);
 
-    COST reuse_cost = ReuseCost(decision, _bbl_data_reuse.getRoot());
-    COST switch_cost = SwitchCost(decision, _bbl_switch_count);
-    auto elapsed_time = ElapsedTime(decision);
-    COST total_time = reuse_cost + switch_cost + elapsed_time.first + elapsed_time.second;
-
-    ofs << "Reuse offloading time (ns): " << total_time << " = CPU " << elapsed_time.first << " + PIM " << elapsed_time.second << " + REUSE " << reuse_cost << " + SWITCH " << switch_cost << std::endl;
+    PrintCostLine(ofs, "Reuse", decision);
 
 
     std::ofstream oo(
         (_command_line_parser->outputfile() + ".debug").c_str(),
         std::ofstream::out);
-    _bbl_switch_count.printSwitch(oo, decision, _switch_cost);
+    _bbl_flat_switch.printSwitch(oo, decision, _switch_cost);
 
     return decision;
 }
 
-COST CostSolver::Cost(const DECISION &decision, const BBLIDTrieNode *reusetree, const SwitchCountList &switchcnt)
+COST CostSolver::Cost(const DECISION &decision)
+{
+    return ParallelCost(decision).total();
+}
+
+// prints "<label> offloading time (ns): <total> = CPU <cpu> + PIM <pim> + REUSE <reuse> + SWITCH <switch><suffix>"
+// and returns the total
+COST CostSolver::PrintCostLine(std::ostream &out, const std::string &label, const DECISION &decision, const std::string &suffix)
+{
+    CostBreakdown cost = ParallelCost(decision);
+    out << label << " offloading time (ns): " << CostToNs(cost.total()) << " = CPU " << CostToNs(cost.cpu) << " + PIM " << CostToNs(cost.pim) << " + REUSE " << CostToNs(cost.reuse) << " + SWITCH " << CostToNs(cost.sw) << suffix << std::endl;
+    return cost.total();
+}
+
+// number of slices that each part of the cost is split into, it does not
+// depend on the thread count, so neither does the order of the reduction
+static const size_t PARALLEL_COST_SLICES = 64;
+// below this many BBLs, switches and reuse entries, the slices are not worth a dispatch
+static const size_t PARALLEL_COST_MIN_WORK = 1 << 15;
+
+// Slice i covers the i-th share of the BBLs, of the switch rows and of the
+// reuse trie root children (or of the reuse constraints with -k constraint).
+// The slices are summed in order after all of them are done.
+// With one worker or a small model, the slices are evaluated in the calling thread,
+// which gives the same result without waking the pool.
+CostBreakdown CostSolver::ParallelCost(const DECISION &decision)
+{
+    bool constraint = (_command_line_parser->reusekernel() == CommandLineParser::ReuseKernel::CONSTRAINT);
+    PackedDecision packed;
+    if (constraint) packed.assign(decision);
+
+    size_t bbl_size = _model.size();
+    size_t row_size = _bbl_flat_switch.rows();
+    size_t root_begin = _bbl_flat_reuse.ChildBegin(0);
+    size_t reuse_size = (constraint ? _reuse_constraints.size() : _bbl_flat_reuse.ChildEnd(0) - root_begin);
+    auto slice = [](size_t size, size_t i) { return size * i / PARALLEL_COST_SLICES; };
+
+    std::vector<CostBreakdown> partial(PARALLEL_COST_SLICES);
+    auto evaluate = [&](size_t i) {
+        CostBreakdown &cost = partial[i];
+        auto pair = ElapsedTime(decision, slice(bbl_size, i), slice(bbl_size, i + 1));
+        cost.cpu = pair.first;
+        cost.pim = pair.second;
+        cost.sw = _bbl_flat_switch.Cost(decision, _switch_cost, slice(row_size, i), slice(row_size, i + 1));
+        if (constraint) {
+            cost.reuse = _reuse_constraints.Cost(packed, _mixed_cost, slice(reuse_size, i), slice(reuse_size, i + 1));
+        }
+        else {
+            cost.reuse = ReuseCost(decision, _bbl_flat_reuse, root_begin + slice(reuse_size, i), root_begin + slice(reuse_size, i + 1));
+        }
+    };
+    if (_thread_pool->size() == 1 || bbl_size + _bbl_flat_switch.size() + reuse_size < PARALLEL_COST_MIN_WORK) {
+        for (size_t i = 0; i < PARALLEL_COST_SLICES; ++i) {
+            evaluate(i);
+        }
+    }
+    else {
+        _thread_pool->ParallelFor(PARALLEL_COST_SLICES, [&](int, size_t i) { evaluate(i); });
+    }
+
+    CostBreakdown result;
+    for (auto &cost : partial) {
+        result.cpu += cost.cpu;
+        result.pim += cost.pim;
+        result.reuse += cost.reuse;
+        result.sw += cost.sw;
+    }
+    return result;
+}
+
+COST CostSolver::Cost(const DECISION &decision, const BBLIDFlatTrie &reusetree, const FlatSwitchCountList &switchcnt)
 {
     auto pair = ElapsedTime(decision);
     return (ReuseCost(decision, reusetree) + SwitchCost(decision, switchcnt) + pair.first + pair.second);
@@ -972,87 +2413,120 @@ COST CostSolver::Cost(const DECISION &decision, const BBLIDTrieNode *reusetree,
 
 COST CostSolver::ElapsedTime(CostSite site)
 {
-    const std::vector<ThreadRunStats *> *sorted = getBBLSortedStats();
     COST elapsed_time = 0;
-    for (BBLID i = 0; i < (BBLID)sorted[site].size(); ++i) {
-        auto *stats = sorted[site][i];
-        elapsed_time += stats->MaxElapsedTime();
+    for (auto time : _model._time[site]) {
+        elapsed_time += time;
     }
     return elapsed_time;
 }
 
 std::pair<COST, COST> CostSolver::ElapsedTime(const DECISION &decision)
+{
+    return ElapsedTime(decision, 0, _model.size());
+}
+
+std::pair<COST, COST> CostSolver::ElapsedTime(const DECISION &decision, size_t begin, size_t end)
 {
     COST cpu_elapsed_time = 0, pim_elapsed_time = 0;
-    const std::vector<ThreadRunStats *> *sorted = getBBLSortedStats();
-    for (uint32_t i = 0; i < sorted[CPU].size(); i++) {
-        auto *cpustats = sorted[CPU][i];
-        auto *pimstats = sorted[PIM][i];
-        if (decision[i] == CPU) {
-            cpu_elapsed_time += cpustats->MaxElapsedTime();
-        }
-        else if (decision[i] == PIM) {
-            pim_elapsed_time += pimstats->MaxElapsedTime();
-        }
-        else {
-            // do nothing, since decision[i] == INVALID means that node i has not
-            // been added to the tree
-        }
+    const COST *cpu_time = _model._time[CPU].data();
+    const COST *pim_time = _model._time[PIM].data();
+    // a masked reduction, decision[i] == INVALID means that node i has not
+    // been added to the tree and is counted on neither site
+    for (size_t i = begin; i < end; i++) {
+        cpu_elapsed_time += (decision[i] == CPU ? cpu_time[i] : 0);
+        pim_elapsed_time += (decision[i] == PIM ? pim_time[i] : 0);
     }
     return std::make_pair(cpu_elapsed_time, pim_elapsed_time);
 }
 
 // decision here can be INVALID
-COST CostSolver::SwitchCost(const DECISION &decision, const SwitchCountList &switchcnt)
+COST CostSolver::SwitchCost(const DECISION &decision, const FlatSwitchCountList &switchcnt)
+{
+    return switchcnt.Cost(decision, _switch_cost);
+}
+
+// evaluate the reuse cost of the BBL level reuse with the kernel selected by -k
+COST CostSolver::ReuseCost(const DECISION &decision)
 {
-    COST cur_switch_cost = 0;
-    for (auto row : switchcnt) {
-        cur_switch_cost += row.Cost(decision, _switch_cost);
+    if (_command_line_parser->reusekernel() == CommandLineParser::ReuseKernel::CONSTRAINT) {
+        return ReuseCost(PackedDecision(decision));
     }
-    
-    return cur_switch_cost;
+    return ReuseCost(decision, _bbl_flat_reuse);
+}
+
+COST CostSolver::ReuseCost(const PackedDecision &decision)
+{
+    return _reuse_constraints.Cost(decision, _mixed_cost);
 }
 
 // decision here should not be INVALID
-COST CostSolver::ReuseCost(const DECISION &decision, const BBLIDTrieNode *reusetree)
+COST CostSolver::ReuseCost(const DECISION &decision, const BBLIDFlatTrie &reusetree)
 {
-    COST cur_reuse_cost = 0;
-    for (auto elem : reusetree->_children) {
-        TrieBFS(cur_reuse_cost, decision, elem.first, elem.second, false);
+    return ReuseCost(decision, reusetree, reusetree.ChildBegin(0), reusetree.ChildEnd(0));
+}
+
+// The reuse cost of one mixed segment whose initial W is on headsite, where the other
+// site has subsequent R/W:
+//     EAGER, the head site flushes and the other site fetches;
+//     WRITE_THROUGH, the head site has written through to memory, so only the other site fetches;
+//     LAZY, PIM runs speculatively and only a conflict, a PIM access to data written on CPU,
+//         is charged as EAGER, while PIM writes are committed with the kernel at no extra cost;
+//     NONE, coherence is free, which bounds the benefit of offloading from above.
+COST CostSolver::MixedCost(CommandLineParser::Coherence protocol, CostSite headsite) const
+{
+    CostSite other = (headsite == CPU ? PIM : CPU);
+    switch (protocol) {
+      case CommandLineParser::Coherence::EAGER:
+        return _flush_cost[headsite] + _fetch_cost[other];
+      case CommandLineParser::Coherence::WRITE_THROUGH:
+        return _fetch_cost[other];
+      case CommandLineParser::Coherence::LAZY:
+        return (headsite == CPU ? _flush_cost[CPU] + _fetch_cost[PIM] : 0);
+      default:
+        return 0;
     }
-    return cur_reuse_cost;
 }
 
-void CostSolver::TrieBFS(COST &cost, const DECISION &decision, BBLID bblid, const BBLIDTrieNode *root, bool isDifferent)
+// The trie is traversed depth first with an explicit stack, in the same order as a
+// recursive traversal. Each entry is a node together with whether its path
+// already contains different sites.
+// only the subtrees of the root children [begin, end) are traversed
+COST CostSolver::ReuseCost(const DECISION &decision, const BBLIDFlatTrie &reusetree, uint32_t begin, uint32_t end)
 {
-    if (root->_isLeaf) {
-        // The cost of a segment is zero if and only if the entire segment is in the same place. In other words, if isDifferent, then the cost is non-zero.
-        if (isDifferent) {
-            // If the initial W is on CPU and there are subsequent R/W on PIM,
-            // then this segment contributes to a flush of CPU and data fetch from PIM.
-            // We conservatively assume that the fetch will promote data to L1
-            assert(bblid == root->_cur);
-            if (decision[root->_cur] == CPU) {
-                cost += root->_count * (_flush_cost[CPU] + _fetch_cost[PIM]);
-            }
-            // If the initial W is on PIM and there are subsequent R/W on CPU,
-            // then this segment contributes to a flush of PIM and data fetch from CPU
-            else {
-                cost += root->_count * (_flush_cost[PIM] + _fetch_cost[CPU]);
-            }
-        }
+    // e.g. -w none, where no segment is ever charged
+    if (_mixed_cost[CPU] == 0 && _mixed_cost[PIM] == 0) return 0;
+
+    COST cur_reuse_cost = 0;
+    std::vector<std::pair<uint32_t, bool>> stack;
+    for (uint32_t i = end; i > begin; --i) {
+        stack.push_back(std::make_pair(i - 1, false));
     }
-    else {
-        for (auto elem : root->_children) {
+
+    while (!stack.empty()) {
+        uint32_t node = stack.back().first;
+        bool isDifferent = stack.back().second;
+        stack.pop_back();
+        BBLID bblid = reusetree._cur[node];
+
+        if (reusetree._isLeaf[node]) {
+            // The cost of a segment is zero if and only if the entire segment is in the same place. In other words, if isDifferent, then the cost is non-zero.
+            // A mixed segment is charged by the site of its initial W, see MixedCost.
             if (isDifferent) {
-                TrieBFS(cost, decision, elem.first, elem.second, true);
-            }
-            else if (decision[bblid] != decision[elem.first]) {
-                TrieBFS(cost, decision, elem.first, elem.second, true);
-            }
-            else {
-                TrieBFS(cost, decision, elem.first, elem.second, false);
+                if (decision[bblid] == CPU) {
+                    cur_reuse_cost += reusetree._count[node] * _mixed_cost[CPU];
+                }
+                else {
+                    cur_reuse_cost += reusetree._count[node] * _mixed_cost[PIM];
+                }
             }
+            continue;
+        }
+
+        CostSite site = decision[bblid];
+        for (uint32_t child = reusetree.ChildEnd(node); child > reusetree.ChildBegin(node); --child) {
+            bool childDifferent = isDifferent || site != decision[reusetree._cur[child - 1]];
+            stack.push_back(std::make_pair(child - 1, childDifferent));
         }
     }
+    return cur_reuse_cost;
 }
@@ -18,11 +18,26 @@
 #include <stack>
 #include <list>
 #include <set>
+#include <map>
 #include <algorithm>
 
 #include "Common.h"
 #include "Util.h"
 #include "Stats.h"
+#include "IncrementalCost.h"
+#include "ThreadPool.h"
+#include "ReuseConstraint.h"
+#include "PackedDecision.h"
+#include "MaxFlow.h"
+#include "BranchAndBound.h"
+#include "Annealing.h"
+#include "Checkpoint.h"
+#include "Hypergraph.h"
+#include "Presolve.h"
+#include "DecisionPool.h"
+#include "MultiSite.h"
+#include "Overlap.h"
+#include "Capacity.h"
 
 namespace PIMProf
 {
@@ -96,11 +111,19 @@ class ThreadRunStats : public RunStats {
         return elapsed_time;
     }
 
+    COST TotalElapsedTime() {
+        COST result = 0;
+        for (COST elem : thread_elapsed_time) {
+            result += elem;
+        }
+        return result;
+    }
+
     void print(std::ostream &ofs) {
         ofs << bblid << ","
             << std::hex << bblhash.first << "," << bblhash.second << "," << std::dec;
         for (auto elem : thread_elapsed_time) {
-            ofs << elem << ",";
+            ofs << CostToNs(elem) << ",";
         }
         ofs << std::endl;
     }
@@ -119,6 +142,55 @@ inline void SortStatsMap(UUIDHashMap<ThreadRunStats *> &statsmap, std::vector<Th
         [](ThreadRunStats *lhs, ThreadRunStats *rhs) { return lhs->bblhash < rhs->bblhash; });
 }
 
+/// Read-only per-BBL stats of both sites, indexed by BBLID and stored as
+/// contiguous arrays, so that the solver does not chase ThreadRunStats
+/// pointers or re-sort thread times in its inner loops.
+/// Built once from the aligned sorted stats after parsing.
+class SolverModel {
+  public:
+    std::vector<UUID> _bblhash;
+    std::vector<COST> _time[MAX_COST_SITE]; // MaxElapsedTime() of each site
+    std::vector<COST> _core_time[MAX_COST_SITE]; // elapsed time summed over all threads
+    std::vector<int> _parallelism[MAX_COST_SITE];
+    std::vector<uint64_t> _instr[MAX_COST_SITE];
+    std::vector<uint64_t> _mem[MAX_COST_SITE];
+
+    void initialize(const std::vector<ThreadRunStats *> sorted[MAX_COST_SITE])
+    {
+        assert(sorted[CPU].size() == sorted[PIM].size());
+        _bblhash.clear();
+        for (auto stats : sorted[CPU]) {
+            _bblhash.push_back(stats->bblhash);
+        }
+        for (int i = 0; i < MAX_COST_SITE; ++i) {
+            _time[i].clear();
+            _core_time[i].clear();
+            _parallelism[i].clear();
+            _instr[i].clear();
+            _mem[i].clear();
+            for (auto stats : sorted[i]) {
+                _core_time[i].push_back(stats->TotalElapsedTime());
+                _time[i].push_back(stats->MaxElapsedTime());
+                _parallelism[i].push_back(stats->parallelism());
+                _instr[i].push_back(stats->instruction_count);
+                _mem[i].push_back(stats->memory_access);
+            }
+        }
+    }
+
+    inline size_t size() const { return _bblhash.size(); }
+};
+
+/// the parts of the cost of a decision, as printed by the solver modes
+struct CostBreakdown {
+    COST cpu = 0;
+    COST pim = 0;
+    COST reuse = 0;
+    COST sw = 0;
+
+    inline COST total() const { return reuse + sw + cpu + pim; }
+};
+
 class CostSolver {
   public:
     typedef DataReuse<ThreadRunStats *> FuncDataReuse;
@@ -128,6 +200,7 @@ class CostSolver {
     typedef DataReuse<BBLID> BBLIDDataReuse;
     typedef DataReuseSegment<BBLID> BBLIDDataReuseSegment;
     typedef TrieNode<BBLID> BBLIDTrieNode;
+    typedef FlatTrie<BBLID> BBLIDFlatTrie;
 
   private:
     CommandLineParser *_command_line_parser;
@@ -136,29 +209,67 @@ class CostSolver {
     // BBLID get_id(Ty elem);
     static BBLID _get_id(BBLID bblid) { return bblid; }
   
-  // track function level runstats
+  // track function level runstats, built by the multilevel mode only
   private:
-    UUIDHashMap<ThreadRunStats *> _func_hash2stats[MAX_COST_SITE];
-    std::vector<ThreadRunStats *> _func_sorted_stats[MAX_COST_SITE];
-    FuncDataReuse _func_data_reuse;
-    SwitchCountList _func_switch_count;
+    std::vector<BBLID> _bbl2func; // the function of each BBL
+    SolverModel _func_model;
+    BBLIDDataReuse _func_data_reuse;
+    FlatSwitchCountList _func_switch_count;
+    CostIndex _func_cost_index;
+
+  // the offload targets after CPU and PIM, built by the multisite mode only
+  private:
+    std::vector<UUIDHashMap<ThreadRunStats *>> _extra_hash2stats;
+    std::vector<std::string> _site_name;
+    std::vector<COST> _site_flush_cost;
+    std::vector<COST> _site_fetch_cost;
+    std::vector<COST> _site_switch_cost; // [from * sites + to]
+    MultiSiteIndex _multi_index;
+
+  // the windows of the overlap cost model, built by the overlap mode only
+  private:
+    std::vector<uint32_t> _overlap_window; // the window of each BBL
+    uint32_t _overlap_windows = 0;
+
+  // the PIM budgets, built by the capacity mode only
+  private:
+    CapacityBudget _capacity;
 
   // track BBL level runstats
   private:
     UUIDHashMap<ThreadRunStats *> _bbl_hash2stats[MAX_COST_SITE];
     std::vector<ThreadRunStats *> _bbl_sorted_stats[MAX_COST_SITE];
     bool _dirty = true; // track if _bbl_sorted_stats is stale
+    SolverModel _model; // dense copy of _bbl_sorted_stats used by the solver
 
     BBLIDDataReuse _bbl_data_reuse;
-    SwitchCountList _bbl_switch_count;
+    BBLIDFlatTrie _bbl_flat_reuse; // frozen copy of _bbl_data_reuse for cost evaluation
+    ReuseConstraintTable _reuse_constraints; // leaves of _bbl_data_reuse as constraints
+    FlatSwitchCountList _bbl_flat_switch; // the switch counts, the row form of the parser is not kept
 
     /// the cache flush/fetch cost of each site, in nanoseconds
     COST _flush_cost[MAX_COST_SITE];
     COST _fetch_cost[MAX_COST_SITE];
+    /// the reuse cost of one mixed segment under the -w coherence protocol, indexed by the site of its head
+    COST _mixed_cost[MAX_COST_SITE];
 
     /// the switch cost FROM each site (TO the other)
     COST _switch_cost[MAX_COST_SITE];
 
+    /// reverse indexes used for incremental cost evaluation
+    CostIndex _cost_index;
+    /// the problem of the CostIndex based searches, _cost_index or the presolved core
+    const CostIndex *_search_index = nullptr;
+    Presolve _presolve;
+
+    ThreadPool *_thread_pool = nullptr;
+    /// per-worker scratch engines of PermuteDecision
+    std::vector<IncrementalCost> _permute_scratch;
+    /// time budget and best decision of the search modes
+    Checkpoint _checkpoint;
+    /// the best distinct decisions, with --top-k
+    DecisionPool _pool;
+
     double _batch_threshold;
     int _batch_size;
     int _mpki_threshold;
@@ -169,9 +280,7 @@ class CostSolver {
     ~CostSolver();
 
     inline COST SingleSegMaxReuseCost() {
-        return std::max(
-            _flush_cost[CPU] + _fetch_cost[PIM],
-            _flush_cost[PIM] + _fetch_cost[CPU]);
+        return std::max(_mixed_cost[CPU], _mixed_cost[PIM]);
     }
 
     void ParseStats(std::istream &ifs, UUIDHashMap<ThreadRunStats *> &stats);
@@ -183,12 +292,19 @@ class CostSolver {
     DECISION PrintSolution(std::ostream &out);
 
 
-    COST Cost(const DECISION &decision, const BBLIDTrieNode *reusetree, const SwitchCountList &switchcnt);
+    COST Cost(const DECISION &decision); // BBL level cost with the selected reuse kernel
+    CostBreakdown ParallelCost(const DECISION &decision); // the same, split into parts and evaluated by the thread pool
+    COST PrintCostLine(std::ostream &out, const std::string &label, const DECISION &decision, const std::string &suffix = "");
+    COST Cost(const DECISION &decision, const BBLIDFlatTrie &reusetree, const FlatSwitchCountList &switchcnt);
     COST ElapsedTime(CostSite site); // return CPU/PIM only elapsed time
     std::pair<COST, COST> ElapsedTime(const DECISION &decision); // return execution time pair (cpu_elapsed_time, pim_elapsed_time) for decision
-    COST SwitchCost(const DECISION &decision, const SwitchCountList &switchcnt);
-    COST ReuseCost(const DECISION &decision, const BBLIDTrieNode *reusetree);
-    void TrieBFS(COST &cost, const DECISION &decision, BBLID bblid, const BBLIDTrieNode *root, bool isDifferent);
+    std::pair<COST, COST> ElapsedTime(const DECISION &decision, size_t begin, size_t end); // BBLs [begin, end) only
+    COST SwitchCost(const DECISION &decision, const FlatSwitchCountList &switchcnt);
+    COST ReuseCost(const DECISION &decision); // BBL level reuse cost with the selected reuse kernel
+    COST ReuseCost(const PackedDecision &decision);
+    COST ReuseCost(const DECISION &decision, const BBLIDFlatTrie &reusetree);
+    COST ReuseCost(const DECISION &decision, const BBLIDFlatTrie &reusetree, uint32_t begin, uint32_t end);
+    COST MixedCost(CommandLineParser::Coherence protocol, CostSite headsite) const; // reuse cost of a mixed segment under protocol
 
     void ReadConfig(ConfigReader &reader);
 
@@ -201,16 +317,50 @@ class CostSolver {
 
   // BBL level to function level stats converter
   private:
-    void BBL2Func(UUIDHashMap<ThreadRunStats *> &bbl, UUIDHashMap<ThreadRunStats *> &func);
-    void BBL2Func(BBLIDDataReuse &bbl, FuncDataReuse &func);
-    void BBL2Func(SwitchCountList &bbl, SwitchCountList &func);
+    void BBL2Func(const SolverModel &bbl, SolverModel &func, std::vector<BBLID> &bbl2func);
+    void BBL2Func(BBLIDDataReuse &bbl, BBLIDDataReuse &func, const std::vector<BBLID> &bbl2func);
+    void BBL2Func(const FlatSwitchCountList &bbl, FlatSwitchCountList &func, const std::vector<BBLID> &bbl2func);
 
   private:
-    COST PermuteDecision(DECISION &decision, const std::vector<BBLID> &cur_batch, const BBLIDTrieNode *partial_root);
+    void BuildCostIndex();
+    COST SingleFlipSearch(DECISION &decision, int iterations);
+    COST PermuteDecision(IncrementalCost &engine, const std::vector<BBLID> &cur_batch, bool parallel = true);
+    AnnealingSchedule MakeAnnealingSchedule(const CostIndex &index, uint64_t iterations);
+    void PrintPresolveStats();
+    void PrintTopK(const DECISION &decision);
+    void BuildMultiSiteIndex();
+    void PrintMultiSiteStats(std::ostream &ofs);
+    std::ostream &PrintMultiSiteDecision(std::ostream &out, const MULTIDECISION &decision);
+    DECISION ToSearch(const DECISION &decision);
+    DECISION FromSearch(const DECISION &decision);
+    COST SearchOffset();
+    std::vector<std::vector<BBLID>> BuildComponents(const CostIndex &index);
+    std::vector<std::vector<BBLID>> BuildHypergraphBlocks();
+    COST PermuteBlocks(IncrementalCost &engine, const std::vector<std::vector<BBLID>> &blocks);
+    DECISION SolveComponent(const CostIndex &index);
+    std::pair<COST, uint64_t> PermuteChunk(IncrementalCost &scratch, const std::vector<BBLID> &cur_batch, int low_bits, uint64_t chunk, COST base_total);
 
     DECISION PrintMPKIStats(std::ostream &ofs);
     DECISION PrintReuseStats(std::ostream &ofs);
     DECISION PrintGreedyStats(std::ostream &ofs);
+    DECISION MinCut(const CostIndex &index, COST *flow = nullptr, const std::vector<COST> *penalty = nullptr);
+    COST LowerBound(const CostIndex &index);
+    DECISION PrintMinCutStats(std::ostream &ofs, COST *optimum = nullptr);
+    DECISION PrintBranchAndBoundStats(std::ostream &ofs, const std::vector<DECISION> &initial);
+    DECISION PrintAnnealingStats(std::ostream &ofs, const std::vector<DECISION> &initial);
+    DECISION PrintComponentStats(std::ostream &ofs);
+    DECISION PrintMultilevelStats(std::ostream &ofs);
+    void BuildOverlapWindows();
+    COST OverlapTotal(const DECISION &decision);
+    CostIndex OverlapRelaxation();
+    DECISION PrintOverlapStats(std::ostream &ofs, const std::vector<DECISION> &initial);
+    void BuildCapacityBudget();
+    DECISION RepairCapacity(const DECISION &decision);
+    DECISION PrintCapacityStats(std::ostream &ofs, COST &bound);
+    BBLID MaxRegions();
+    BBLID CountRegions(const DECISION &decision);
+    DECISION RepairRegions(const DECISION &decision, BBLID max_regions);
+    DECISION PrintRegionStats(std::ostream &ofs, COST &bound);
     void PrintDisjointSets(std::ostream &ofs);
     DECISION Debug_StartFromUnimportantSegment(std::ostream &ofs);
     DECISION Debug_ConsiderSwitchCost(std::ostream &ofs);
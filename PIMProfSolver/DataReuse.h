@@ -114,7 +114,7 @@ class SwitchCountList{
         inline const std::vector<std::pair<int64_t, uint64_t>>::const_iterator begin() const { return _toidxvec.begin(); }
         inline const std::vector<std::pair<int64_t, uint64_t>>::const_iterator end() const { return _toidxvec.end(); }
 
-        COST Cost(const DECISION &decision, const COST switch_cost[MAX_COST_SITE]) {
+        COST Cost(const DECISION &decision, const COST switch_cost[MAX_COST_SITE]) const {
             if (_toidxvec.size() == 0) return 0;
             COST result = 0;
             for (auto &elem : _toidxvec) {
@@ -173,29 +173,111 @@ public:
         }
         return out;
     }
+};
+
+
+/* ===================================================================== */
+/* FlatSwitchCountList */
+/* ===================================================================== */
+/// The switch counts in CSR form, built from the SwitchCountList of the parser,
+/// which is dropped afterwards. The switches from BBL i are
+/// [_row_begin[i], _row_begin[i + 1]) of _toidx and the counts, in the order of the rows.
+/// BBLIDs are stored in 32 bits and the from BBL is implied by the row.
+/// Counts are stored in 32 bits (_count32) unless one of them does not fit,
+/// then all of them are stored in 64 bits (_count64).
+class FlatSwitchCountList
+{
+public:
+    std::vector<uint32_t> _row_begin;
+    std::vector<uint32_t> _toidx;
+    std::vector<uint32_t> _count32;
+    std::vector<uint64_t> _count64;
 
-    std::ostream &printSwitch(std::ostream &out, const DECISION &decision, const COST switch_cost[MAX_COST_SITE])
+public:
+    void initialize(const SwitchCountList &switchcnt)
     {
-        for (auto &row : _count) {
-            COST cost = row.Cost(decision, switch_cost);
+        _row_begin.assign(1, 0);
+        _toidx.clear();
+        _count32.clear();
+        _count64.clear();
+        bool wide = false;
+        for (auto &row : switchcnt) {
+            for (auto &elem : row) {
+                if (elem.second > UINT32_MAX) wide = true;
+            }
+        }
+        for (auto &row : switchcnt) {
+            assert(row._fromidx == (int64_t)_row_begin.size() - 1);
+            for (auto &elem : row) {
+                assert(elem.first >= 0 && elem.first < UINT32_MAX);
+                _toidx.push_back(elem.first);
+                if (wide) _count64.push_back(elem.second);
+                else _count32.push_back(elem.second);
+            }
+            _row_begin.push_back(_toidx.size());
+        }
+    }
+
+    inline uint32_t rows() const { return _row_begin.size() - 1; }
+    inline uint32_t size() const { return _toidx.size(); }
+    inline uint32_t RowBegin(BBLID from) const { return (from < (BBLID)rows() ? _row_begin[from] : size()); }
+    inline uint32_t RowEnd(BBLID from) const { return (from < (BBLID)rows() ? _row_begin[from + 1] : size()); }
+    inline uint64_t count(uint32_t e) const { return (_count64.empty() ? _count32[e] : _count64[e]); }
+
+    /// decision can be a DECISION or a PackedDecision, and can be INVALID
+    template <class DecisionTy>
+    COST Cost(const DecisionTy &decision, const COST switch_cost[MAX_COST_SITE]) const
+    {
+        return Cost(decision, switch_cost, 0, rows());
+    }
+
+    /// only the switches from BBLs [begin, end)
+    template <class DecisionTy>
+    COST Cost(const DecisionTy &decision, const COST switch_cost[MAX_COST_SITE], uint32_t begin, uint32_t end) const
+    {
+        if (_count64.empty()) return Cost(decision, switch_cost, begin, end, _count32.data());
+        return Cost(decision, switch_cost, begin, end, _count64.data());
+    }
+
+    std::ostream &printSwitch(std::ostream &out, const DECISION &decision, const COST switch_cost[MAX_COST_SITE]) const
+    {
+        for (uint32_t from = 0; from < rows(); ++from) {
+            COST cost = Cost(decision, switch_cost, from, from + 1);
             if (cost == 0) continue;
-            CostSite fromsite = decision[row._fromidx];
-            out << "cost = " << cost << ", ";
-            out << "from = " << row._fromidx << getCostSiteString(fromsite) << " | ";
-            for (auto &elem : row._toidxvec) {
-                BBLID toidx = elem.first;
-                CostSite tosite = decision[toidx];
-                uint64_t count = elem.second;
+            CostSite fromsite = decision[from];
+            out << "cost = " << CostToNs(cost) << ", ";
+            out << "from = " << from << getCostSiteString(fromsite) << " | ";
+            for (uint32_t e = _row_begin[from]; e < _row_begin[from + 1]; ++e) {
+                CostSite tosite = decision[_toidx[e]];
                 if (fromsite != INVALID && tosite != INVALID && fromsite != tosite) {
-                    out << toidx << getCostSiteString(tosite) << ":" << count << " ";
+                    out << _toidx[e] << getCostSiteString(tosite) << ":" << count(e) << " ";
                 }
             }
             out << std::endl;
         }
         return out;
     }
-};
 
+private:
+    template <class DecisionTy, class CountTy>
+    COST Cost(const DecisionTy &decision, const COST switch_cost[MAX_COST_SITE], uint32_t begin, uint32_t end, const CountTy *counts) const
+    {
+        COST result = 0;
+        for (uint32_t from = begin; from < end; ++from) {
+            CostSite fromsite = decision[from];
+            if (fromsite == INVALID) continue;
+            // the counts are integers, so they are summed before being
+            // converted to cost, without any branch on the sites
+            uint64_t count = 0;
+            for (uint32_t e = _row_begin[from]; e < _row_begin[from + 1]; ++e) {
+                CostSite tosite = decision[_toidx[e]];
+                count += (tosite != INVALID && tosite != fromsite) ? counts[e] : 0;
+            }
+            result += switch_cost[fromsite] * count;
+        }
+        return result;
+    }
+};
 
 /* ===================================================================== */
 /* DataReuseSegment */
@@ -297,6 +379,51 @@ public:
     }
 };
 
+/* ===================================================================== */
+/* FlatTrie */
+/* ===================================================================== */
+/// A frozen copy of a reuse trie in CSR form, nodes are numbered in BFS order
+/// so the children of node i are the contiguous range
+/// [_child_begin[i], _child_begin[i + 1]), and node 0 is the root.
+/// The trie must not change after it is frozen.
+template <class Ty>
+class FlatTrie
+{
+public:
+    std::vector<Ty> _cur;
+    std::vector<uint64_t> _count;
+    std::vector<uint32_t> _child_begin;
+    std::vector<uint8_t> _isLeaf;
+
+public:
+    void initialize(const TrieNode<Ty> *root)
+    {
+        _cur.clear();
+        _count.clear();
+        _child_begin.clear();
+        _isLeaf.clear();
+
+        std::vector<const TrieNode<Ty> *> order(1, root);
+        for (size_t i = 0; i < order.size(); ++i) {
+            const TrieNode<Ty> *node = order[i];
+            _cur.push_back(node->_cur);
+            _count.push_back(node->_count);
+            _isLeaf.push_back(node->_isLeaf);
+            _child_begin.push_back(order.size());
+            if (!node->_isLeaf) {
+                for (auto it : node->_children) {
+                    order.push_back(it.second);
+                }
+            }
+        }
+        _child_begin.push_back(order.size());
+    }
+
+    inline uint32_t size() const { return _cur.size(); }
+    inline uint32_t ChildBegin(uint32_t node) const { return _child_begin[node]; }
+    inline uint32_t ChildEnd(uint32_t node) const { return _child_begin[node + 1]; }
+};
+
 /* ===================================================================== */
 /* DataReuse */
 /* ===================================================================== */
@@ -388,9 +515,10 @@ public:
         }
     }
 
-    // Sort leaves by _count in descending order
+    // Sort leaves by _count in descending order,
+    // stable so that leaf indexes are not shuffled by repeated calls
     void SortLeaves() {
-        std::sort(_leaves.begin(), _leaves.end(),
+        std::stable_sort(_leaves.begin(), _leaves.end(),
             [] (const TrieNode<Ty> *lhs, const TrieNode<Ty> *rhs) { return lhs->_count > rhs->_count; });
     }
 
@@ -0,0 +1,96 @@
+//===- DecisionPool.h - The best distinct decisions of a solve --*- C++ -*-===//
+//
+//
+//===----------------------------------------------------------------------===//
+//
+//
+//===----------------------------------------------------------------------===//
+#ifndef __DECISIONPOOL_H__
+#define __DECISIONPOOL_H__
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <functional>
+
+#include "Common.h"
+
+namespace PIMProf
+{
+/* ===================================================================== */
+/* DecisionPool */
+/* ===================================================================== */
+/// Keeps up to _capacity decisions in ascending order of cost, any two of which
+/// differ in at least _min_distance BBLs.
+/// A new decision replaces the pooled ones closer than _min_distance to it if it is
+/// cheaper than all of them, and is dropped otherwise. Safe to call from workers.
+/// With SetFilter(), only the decisions accepted by the filter are kept,
+/// e.g., the ones that meet the constraints of the mode.
+class DecisionPool
+{
+  public:
+    typedef std::function<bool(const DECISION &)> Filter;
+
+  private:
+    size_t _capacity = 0;
+    BBLID _min_distance = 1;
+    Filter _filter;
+    std::vector<std::pair<COST, DECISION>> _entries;
+    std::mutex _mutex;
+
+  public:
+    void initialize(size_t capacity, BBLID min_distance)
+    {
+        _capacity = capacity;
+        _min_distance = std::max<BBLID>(min_distance, 1);
+        _entries.clear();
+    }
+
+    void SetFilter(Filter filter) { _filter = filter; }
+
+    /// the number of BBLs on different sites, stops counting at limit
+    inline static BBLID Distance(const DECISION &lhs, const DECISION &rhs, BBLID limit)
+    {
+        BBLID distance = 0;
+        for (size_t i = 0; i < lhs.size() && distance < limit; ++i) {
+            if (lhs[i] != rhs[i]) distance++;
+        }
+        return distance;
+    }
+
+    /// returns true if decision is kept
+    bool Offer(const DECISION &decision, COST cost)
+    {
+        if (_filter && !_filter(decision)) return false;
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_capacity == 0) return false;
+        if (_entries.size() == _capacity && cost >= _entries.back().first) return false;
+
+        std::vector<size_t> close;
+        for (size_t i = 0; i < _entries.size(); ++i) {
+            if (Distance(_entries[i].second, decision, _min_distance) < _min_distance) {
+                if (_entries[i].first <= cost) return false;
+                close.push_back(i);
+            }
+        }
+        for (auto it = close.rbegin(); it != close.rend(); ++it) {
+            _entries.erase(_entries.begin() + *it);
+        }
+
+        auto pos = std::upper_bound(_entries.begin(), _entries.end(), cost,
+            [](COST lhs, const std::pair<COST, DECISION> &rhs) { return lhs < rhs.first; });
+        _entries.insert(pos, std::make_pair(cost, decision));
+        if (_entries.size() > _capacity) _entries.pop_back();
+        return true;
+    }
+
+    inline size_t size() const { return _entries.size(); }
+    inline size_t capacity() const { return _capacity; }
+    inline BBLID MinDistance() const { return _min_distance; }
+    inline const DECISION &decision(size_t i) const { return _entries[i].second; }
+    inline COST cost(size_t i) const { return _entries[i].first; }
+};
+
+} // namespace PIMProf
+
+#endif // __DECISIONPOOL_H__
@@ -0,0 +1,279 @@
+//===- Hypergraph.h - Hypergraph partitioning into small blocks -*- C++ -*-===//
+//
+//
+//===----------------------------------------------------------------------===//
+//
+//
+//===----------------------------------------------------------------------===//
+#ifndef __HYPERGRAPH_H__
+#define __HYPERGRAPH_H__
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+#include "Common.h"
+
+namespace PIMProf
+{
+/* ===================================================================== */
+/* Hypergraph */
+/* ===================================================================== */
+/// Vertices 0 ... size - 1 and weighted hyperedges in CSR form,
+/// hyperedge e has pins _pin[_edge_begin[e]] ... _pin[_edge_begin[e + 1] - 1].
+class Hypergraph
+{
+  public:
+    BBLID _size = 0;
+    std::vector<uint32_t> _edge_begin;
+    std::vector<BBLID> _pin;
+    std::vector<double> _weight;
+
+    /// reverse index from vertices to hyperedges, built by Finalize()
+    std::vector<uint32_t> _vertex_begin;
+    std::vector<uint32_t> _vertex_edge;
+
+  public:
+    Hypergraph(BBLID size = 0) : _size(size), _edge_begin(1, 0) {}
+
+    inline uint32_t EdgeCount() const { return _weight.size(); }
+    inline uint32_t EdgeSize(uint32_t e) const { return _edge_begin[e + 1] - _edge_begin[e]; }
+
+    /// pins must be distinct, hyperedges with less than two pins are dropped
+    void AddEdge(const std::vector<BBLID> &pins, double weight)
+    {
+        if (pins.size() < 2 || weight <= 0) return;
+        _pin.insert(_pin.end(), pins.begin(), pins.end());
+        _edge_begin.push_back(_pin.size());
+        _weight.push_back(weight);
+    }
+
+    void Finalize()
+    {
+        _vertex_begin.assign(_size + 1, 0);
+        for (BBLID v : _pin) {
+            _vertex_begin[v + 1]++;
+        }
+        for (BBLID v = 0; v < _size; ++v) {
+            _vertex_begin[v + 1] += _vertex_begin[v];
+        }
+        std::vector<uint32_t> pos(_vertex_begin.begin(), _vertex_begin.end() - 1);
+        _vertex_edge.resize(_pin.size());
+        for (uint32_t e = 0; e < EdgeCount(); ++e) {
+            for (uint32_t p = _edge_begin[e]; p < _edge_begin[e + 1]; ++p) {
+                _vertex_edge[pos[_pin[p]]++] = e;
+            }
+        }
+    }
+
+    /// the total weight of hyperedges whose pins are in more than one block
+    double CutWeight(const std::vector<BBLID> &block) const
+    {
+        double cut = 0;
+        for (uint32_t e = 0; e < EdgeCount(); ++e) {
+            for (uint32_t p = _edge_begin[e] + 1; p < _edge_begin[e + 1]; ++p) {
+                if (block[_pin[p]] != block[_pin[_edge_begin[e]]]) {
+                    cut += _weight[e];
+                    break;
+                }
+            }
+        }
+        return cut;
+    }
+};
+
+/* ===================================================================== */
+/* HypergraphPartitioner */
+/* ===================================================================== */
+/// Partitions a hypergraph into blocks of at most _max_block_size vertices,
+/// trying to keep heavy hyperedges inside one block.
+///
+/// Coarsening: at each level, every cluster is matched with the unmatched neighbor
+/// cluster of the highest rating that still fits, where two clusters are rated by
+///     sum of w(e) / (k(e) - 1) over hyperedges e containing both, divided by the product of their sizes,
+/// and k(e) is the number of clusters e touches. Matched pairs are contracted,
+/// until no pair can be merged. The clusters of the coarsest level are the initial blocks.
+///
+/// Refinement: vertices are moved to the neighboring block with the highest
+/// connectivity (the same rating, summed over the pins in the block), if it fits.
+///
+/// Hyperedges with more pins than _max_block_size are always cut and are ignored.
+/// The result is deterministic.
+class HypergraphPartitioner
+{
+  public:
+    static const int MAX_LEVELS = 64;
+    static const int REFINE_PASSES = 4;
+
+  private:
+    const Hypergraph *_graph;
+    BBLID _max_block_size;
+
+  public:
+    HypergraphPartitioner(const Hypergraph *graph, BBLID max_block_size)
+        : _graph(graph), _max_block_size(max_block_size)
+    {
+        assert(max_block_size >= 1);
+    }
+
+    /// returns the block of each vertex, blocks are numbered by their smallest vertex
+    std::vector<BBLID> Partition()
+    {
+        BBLID size = _graph->_size;
+        std::vector<BBLID> cluster(size);
+        for (BBLID v = 0; v < size; ++v) {
+            cluster[v] = v;
+        }
+        std::vector<BBLID> cluster_size(size, 1);
+
+        for (int level = 0; level < MAX_LEVELS; ++level) {
+            if (Coarsen(cluster, cluster_size) == 0) break;
+        }
+        Refine(cluster, cluster_size);
+        return Renumber(cluster);
+    }
+
+  private:
+    inline bool Usable(uint32_t e) const
+    {
+        return _graph->EdgeSize(e) <= (uint32_t)_max_block_size;
+    }
+
+    /// one level of matching and contraction, returns the number of merged pairs
+    BBLID Coarsen(std::vector<BBLID> &cluster, std::vector<BBLID> &cluster_size)
+    {
+        const Hypergraph &g = *_graph;
+
+        // (cu, cv, rating) of every pair of clusters sharing a hyperedge
+        std::vector<std::pair<std::pair<BBLID, BBLID>, double>> pairs;
+        std::vector<BBLID> touched;
+        for (uint32_t e = 0; e < g.EdgeCount(); ++e) {
+            if (!Usable(e)) continue;
+            touched.clear();
+            for (uint32_t p = g._edge_begin[e]; p < g._edge_begin[e + 1]; ++p) {
+                touched.push_back(cluster[g._pin[p]]);
+            }
+            std::sort(touched.begin(), touched.end());
+            touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+            if (touched.size() < 2) continue;
+            double w = g._weight[e] / (touched.size() - 1);
+            for (size_t i = 0; i < touched.size(); ++i) {
+                for (size_t j = 0; j < touched.size(); ++j) {
+                    if (i != j) pairs.push_back(std::make_pair(std::make_pair(touched[i], touched[j]), w));
+                }
+            }
+        }
+        std::sort(pairs.begin(), pairs.end());
+
+        // heaviest fitting neighbor of each cluster, visited in cluster order
+        std::vector<BBLID> match(cluster.size(), -1);
+        BBLID merged = 0;
+        size_t i = 0;
+        while (i < pairs.size()) {
+            BBLID cu = pairs[i].first.first;
+            BBLID best = -1;
+            double best_rating = 0;
+            while (i < pairs.size() && pairs[i].first.first == cu) {
+                BBLID cv = pairs[i].first.second;
+                double rating = 0;
+                while (i < pairs.size() && pairs[i].first.first == cu && pairs[i].first.second == cv) {
+                    rating += pairs[i].second;
+                    ++i;
+                }
+                if (match[cu] >= 0 || match[cv] >= 0) continue;
+                if (cluster_size[cu] + cluster_size[cv] > _max_block_size) continue;
+                rating /= (double)cluster_size[cu] * cluster_size[cv];
+                if (rating > best_rating) {
+                    best_rating = rating;
+                    best = cv;
+                }
+            }
+            if (best >= 0 && match[cu] < 0) {
+                // the smaller id becomes the representative
+                BBLID rep = std::min(cu, best);
+                match[cu] = match[best] = rep;
+                cluster_size[rep] = cluster_size[cu] + cluster_size[best];
+                merged++;
+            }
+        }
+
+        for (auto &c : cluster) {
+            if (match[c] >= 0) c = match[c];
+        }
+        return merged;
+    }
+
+    /// connectivity of vertex v to the blocks of its neighbors
+    void Connectivity(BBLID v, const std::vector<BBLID> &block, std::vector<std::pair<BBLID, double>> &conn) const
+    {
+        const Hypergraph &g = *_graph;
+        conn.clear();
+        for (uint32_t i = g._vertex_begin[v]; i < g._vertex_begin[v + 1]; ++i) {
+            uint32_t e = g._vertex_edge[i];
+            if (!Usable(e)) continue;
+            double w = g._weight[e] / (g.EdgeSize(e) - 1);
+            for (uint32_t p = g._edge_begin[e]; p < g._edge_begin[e + 1]; ++p) {
+                if (g._pin[p] != v) conn.push_back(std::make_pair(block[g._pin[p]], w));
+            }
+        }
+        std::sort(conn.begin(), conn.end());
+        size_t out = 0;
+        for (size_t i = 0; i < conn.size(); ++i) {
+            if (out > 0 && conn[out - 1].first == conn[i].first) {
+                conn[out - 1].second += conn[i].second;
+            }
+            else {
+                conn[out++] = conn[i];
+            }
+        }
+        conn.resize(out);
+    }
+
+    void Refine(std::vector<BBLID> &block, std::vector<BBLID> &block_size)
+    {
+        std::vector<std::pair<BBLID, double>> conn;
+        for (int pass = 0; pass < REFINE_PASSES; ++pass) {
+            BBLID moved = 0;
+            for (BBLID v = 0; v < _graph->_size; ++v) {
+                Connectivity(v, block, conn);
+                double own = 0;
+                for (auto &elem : conn) {
+                    if (elem.first == block[v]) own = elem.second;
+                }
+                BBLID best = block[v];
+                double best_conn = own;
+                for (auto &elem : conn) {
+                    if (elem.first == block[v] || block_size[elem.first] + 1 > _max_block_size) continue;
+                    if (elem.second > best_conn) {
+                        best_conn = elem.second;
+                        best = elem.first;
+                    }
+                }
+                if (best != block[v]) {
+                    block_size[block[v]]--;
+                    block_size[best]++;
+                    block[v] = best;
+                    moved++;
+                }
+            }
+            if (moved == 0) break;
+        }
+    }
+
+    std::vector<BBLID> Renumber(const std::vector<BBLID> &cluster) const
+    {
+        std::vector<BBLID> id(cluster.size(), -1);
+        std::vector<BBLID> block(cluster.size());
+        BBLID blocks = 0;
+        for (BBLID v = 0; v < (BBLID)cluster.size(); ++v) {
+            if (id[cluster[v]] < 0) id[cluster[v]] = blocks++;
+            block[v] = id[cluster[v]];
+        }
+        return block;
+    }
+};
+
+} // namespace PIMProf
+
+#endif // __HYPERGRAPH_H__
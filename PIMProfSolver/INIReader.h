@@ -160,8 +160,9 @@ inline static char* find_chars_or_comment(const char* s, const char* chars)
 /* Version of strncpy that ensures dest (size bytes) is null-terminated. */
 inline static char* strncpy0(char* dest, const char* src, size_t size)
 {
-    strncpy(dest, src, size);
-    dest[size - 1] = '\0';
+    size_t len = strnlen(src, size - 1);
+    memcpy(dest, src, len);
+    dest[len] = '\0';
     return dest;
 }
 
@@ -0,0 +1,382 @@
+//===- IncrementalCost.h - Incremental cost of decision flips ---*- C++ -*-===//
+//
+//
+//===----------------------------------------------------------------------===//
+//
+//
+//===----------------------------------------------------------------------===//
+#ifndef __INCREMENTALCOST_H__
+#define __INCREMENTALCOST_H__
+
+#include <vector>
+#include <cassert>
+
+#include "Common.h"
+#include "DataReuse.h"
+
+namespace PIMProf
+{
+/* ===================================================================== */
+/* CostIndex */
+/* ===================================================================== */
+/// A read-only view of the cost model, built once after parsing.
+/// Every leaf of the reuse trie becomes a reuse constraint (members, head, count),
+/// every (from, to, count) entry of the FlatSwitchCountList becomes a switch edge,
+/// and each BBL keeps a reverse index to the constraints and edges it appears in,
+/// so that the cost change of flipping one BBL only touches its own neighborhood.
+class CostIndex
+{
+  public:
+    BBLID _size = 0;
+
+    /// elapsed time of each BBL on each site
+    std::vector<COST> _elapsed[MAX_COST_SITE];
+
+    /// reuse cost of one mixed segment, indexed by the site of its head
+    COST _mixed_cost[MAX_COST_SITE];
+    COST _switch_cost[MAX_COST_SITE];
+
+    /// reuse constraints in CSR form, leaf i has members
+    /// _leaf_member[_leaf_begin[i]] ... _leaf_member[_leaf_begin[i + 1] - 1]
+    std::vector<BBLID> _leaf_head;
+    std::vector<uint64_t> _leaf_count;
+    std::vector<uint32_t> _leaf_begin;
+    std::vector<BBLID> _leaf_member;
+
+    /// switch edges
+    std::vector<BBLID> _edge_from;
+    std::vector<BBLID> _edge_to;
+    std::vector<uint64_t> _edge_count;
+
+    /// reverse indexes from BBLID to leaves and edges, also in CSR form
+    std::vector<uint32_t> _bbl_leaf_begin;
+    std::vector<uint32_t> _bbl_leaf;
+    std::vector<uint32_t> _bbl_edge_begin;
+    std::vector<uint32_t> _bbl_edge;
+
+  public:
+    void initialize(
+        const std::vector<COST> elapsed[MAX_COST_SITE],
+        DataReuse<BBLID> &reuse,
+        const FlatSwitchCountList &switchcnt,
+        const COST mixed_cost[MAX_COST_SITE],
+        const COST switch_cost[MAX_COST_SITE])
+    {
+        _size = elapsed[CPU].size();
+        for (int i = 0; i < MAX_COST_SITE; ++i) {
+            _elapsed[i] = elapsed[i];
+            _mixed_cost[i] = mixed_cost[i];
+            _switch_cost[i] = switch_cost[i];
+        }
+
+        _leaf_head.clear();
+        _leaf_count.clear();
+        _leaf_begin.assign(1, 0);
+        _leaf_member.clear();
+        for (auto leaf : reuse.getLeaves()) {
+            DataReuseSegment<BBLID> seg;
+            reuse.ExportSegment(&seg, leaf);
+            seg.insert(seg.getHead());
+            _leaf_head.push_back(seg.getHead());
+            _leaf_count.push_back(seg.getCount());
+            _leaf_member.insert(_leaf_member.end(), seg.begin(), seg.end());
+            _leaf_begin.push_back(_leaf_member.size());
+        }
+
+        _edge_from.clear();
+        _edge_to.clear();
+        _edge_count.clear();
+        for (uint32_t from = 0; from < switchcnt.rows(); ++from) {
+            for (uint32_t e = switchcnt._row_begin[from]; e < switchcnt._row_begin[from + 1]; ++e) {
+                _edge_from.push_back(from);
+                _edge_to.push_back(switchcnt._toidx[e]);
+                _edge_count.push_back(switchcnt.count(e));
+            }
+        }
+
+        BuildReverseIndex();
+    }
+
+    /// the sub-problem of bbls, which must contain every BBL that shares a leaf or an edge
+    /// with one of them, e.g., a connected component.
+    /// BBL bbls[i] of index becomes BBL i, and local[bbls[i]] must be i.
+    void initialize(const CostIndex &index, const std::vector<BBLID> &bbls, const std::vector<BBLID> &local)
+    {
+        _size = bbls.size();
+        for (int i = 0; i < MAX_COST_SITE; ++i) {
+            _elapsed[i].resize(_size);
+            for (BBLID j = 0; j < _size; ++j) {
+                _elapsed[i][j] = index._elapsed[i][bbls[j]];
+            }
+            _mixed_cost[i] = index._mixed_cost[i];
+            _switch_cost[i] = index._switch_cost[i];
+        }
+
+        // each leaf is taken by its first member, and each edge by its from BBL
+        _leaf_head.clear();
+        _leaf_count.clear();
+        _leaf_begin.assign(1, 0);
+        _leaf_member.clear();
+        _edge_from.clear();
+        _edge_to.clear();
+        _edge_count.clear();
+        for (BBLID bblid : bbls) {
+            for (uint32_t i = index._bbl_leaf_begin[bblid]; i < index._bbl_leaf_begin[bblid + 1]; ++i) {
+                uint32_t leaf = index._bbl_leaf[i];
+                if (index._leaf_member[index._leaf_begin[leaf]] != bblid) continue;
+                _leaf_head.push_back(local[index._leaf_head[leaf]]);
+                _leaf_count.push_back(index._leaf_count[leaf]);
+                for (uint32_t m = index._leaf_begin[leaf]; m < index._leaf_begin[leaf + 1]; ++m) {
+                    _leaf_member.push_back(local[index._leaf_member[m]]);
+                }
+                _leaf_begin.push_back(_leaf_member.size());
+            }
+            for (uint32_t i = index._bbl_edge_begin[bblid]; i < index._bbl_edge_begin[bblid + 1]; ++i) {
+                uint32_t e = index._bbl_edge[i];
+                if (index._edge_from[e] != bblid) continue;
+                _edge_from.push_back(local[bblid]);
+                _edge_to.push_back(local[index._edge_to[e]]);
+                _edge_count.push_back(index._edge_count[e]);
+            }
+        }
+
+        BuildReverseIndex();
+    }
+
+    inline uint32_t LeafSize(uint32_t leaf) const { return _leaf_begin[leaf + 1] - _leaf_begin[leaf]; }
+    inline uint32_t LeafCount() const { return _leaf_head.size(); }
+    inline uint32_t EdgeCount() const { return _edge_from.size(); }
+
+    /// also called by the builders that fill in the leaves and edges directly
+    void BuildReverseIndex()
+    {
+        _bbl_leaf_begin.assign(_size + 1, 0);
+        for (BBLID bblid : _leaf_member) {
+            _bbl_leaf_begin[bblid + 1]++;
+        }
+        _bbl_edge_begin.assign(_size + 1, 0);
+        for (uint32_t e = 0; e < EdgeCount(); ++e) {
+            _bbl_edge_begin[_edge_from[e] + 1]++;
+            // a self loop is only indexed once
+            if (_edge_to[e] != _edge_from[e])
+                _bbl_edge_begin[_edge_to[e] + 1]++;
+        }
+        for (BBLID i = 0; i < _size; ++i) {
+            _bbl_leaf_begin[i + 1] += _bbl_leaf_begin[i];
+            _bbl_edge_begin[i + 1] += _bbl_edge_begin[i];
+        }
+
+        std::vector<uint32_t> pos(_bbl_leaf_begin.begin(), _bbl_leaf_begin.end() - 1);
+        _bbl_leaf.resize(_leaf_member.size());
+        for (uint32_t leaf = 0; leaf < LeafCount(); ++leaf) {
+            for (uint32_t m = _leaf_begin[leaf]; m < _leaf_begin[leaf + 1]; ++m) {
+                _bbl_leaf[pos[_leaf_member[m]]++] = leaf;
+            }
+        }
+
+        pos.assign(_bbl_edge_begin.begin(), _bbl_edge_begin.end() - 1);
+        _bbl_edge.resize(_bbl_edge_begin[_size]);
+        for (uint32_t e = 0; e < EdgeCount(); ++e) {
+            _bbl_edge[pos[_edge_from[e]]++] = e;
+            if (_edge_to[e] != _edge_from[e])
+                _bbl_edge[pos[_edge_to[e]]++] = e;
+        }
+    }
+};
+
+/* ===================================================================== */
+/* IncrementalCost */
+/* ===================================================================== */
+/// Holds a decision together with its CPU, PIM, REUSE and SWITCH totals.
+/// The cost change of assigning one BBL is computed in time proportional to
+/// the number of reuse constraints and switch edges that BBL appears in.
+///
+/// The decision may contain INVALID, with the same meaning as in CostSolver::Cost:
+/// an INVALID BBL has no elapsed time, no switch cost,
+/// and counts as a different site in a reuse segment.
+///
+/// Reuse constraints can be activated one by one, which has the same effect as
+/// evaluating the cost against a partial reuse trie that contains only those leaves.
+class IncrementalCost
+{
+  private:
+    // per-leaf count of members on CPU, PIM and INVALID
+    static const int SLOT_NUM = 3;
+
+    const CostIndex *_index = nullptr;
+    DECISION _decision;
+    std::vector<uint32_t> _leaf_site_count;
+    std::vector<uint8_t> _leaf_active;
+
+    COST _elapsed_cost[MAX_COST_SITE];
+    COST _reuse_cost;
+    COST _switch_cost;
+
+    static inline int Slot(CostSite site) { return (site == CPU || site == PIM) ? site : MAX_COST_SITE; }
+
+    inline COST LeafCost(uint32_t leaf, const uint32_t *count, CostSite headsite) const
+    {
+        uint32_t size = _index->LeafSize(leaf);
+        if (count[CPU] == size || count[PIM] == size || count[MAX_COST_SITE] == size)
+            return 0;
+        // follow CostSolver::ReuseCost, a head that is not on CPU is charged as PIM
+        return _index->_leaf_count[leaf] * _index->_mixed_cost[headsite == CPU ? CPU : PIM];
+    }
+
+    inline COST EdgeCost(uint32_t edge, CostSite fromsite, CostSite tosite) const
+    {
+        if (fromsite == INVALID || tosite == INVALID || fromsite == tosite)
+            return 0;
+        return _index->_switch_cost[fromsite] * _index->_edge_count[edge];
+    }
+
+    inline CostSite SiteAfter(BBLID elem, BBLID bblid, CostSite site) const
+    {
+        return (elem == bblid ? site : _decision[elem]);
+    }
+
+  public:
+    IncrementalCost() {}
+
+    IncrementalCost(const CostIndex *index, const DECISION &decision, bool activeleaves = true)
+    {
+        initialize(index, decision, activeleaves);
+    }
+
+    void initialize(const CostIndex *index, const DECISION &decision, bool activeleaves = true)
+    {
+        _index = index;
+        _leaf_active.assign(_index->LeafCount(), activeleaves);
+        Reset(decision);
+    }
+
+    /// recompute everything from scratch, also removes accumulated rounding error
+    void Reset(const DECISION &decision)
+    {
+        assert((BBLID)decision.size() == _index->_size);
+        _decision = decision;
+        for (int i = 0; i < MAX_COST_SITE; ++i) {
+            _elapsed_cost[i] = 0;
+        }
+        for (BBLID i = 0; i < _index->_size; ++i) {
+            if (_decision[i] == CPU || _decision[i] == PIM)
+                _elapsed_cost[_decision[i]] += _index->_elapsed[_decision[i]][i];
+        }
+
+        _reuse_cost = 0;
+        _leaf_site_count.assign(_index->LeafCount() * SLOT_NUM, 0);
+        for (uint32_t leaf = 0; leaf < _index->LeafCount(); ++leaf) {
+            uint32_t *count = &_leaf_site_count[leaf * SLOT_NUM];
+            for (uint32_t m = _index->_leaf_begin[leaf]; m < _index->_leaf_begin[leaf + 1]; ++m) {
+                count[Slot(_decision[_index->_leaf_member[m]])]++;
+            }
+            if (_leaf_active[leaf])
+                _reuse_cost += LeafCost(leaf, count, _decision[_index->_leaf_head[leaf]]);
+        }
+
+        _switch_cost = 0;
+        for (uint32_t e = 0; e < _index->EdgeCount(); ++e) {
+            _switch_cost += EdgeCost(e, _decision[_index->_edge_from[e]], _decision[_index->_edge_to[e]]);
+        }
+    }
+
+    /// start charging the reuse cost of leaf
+    void ActivateLeaf(uint32_t leaf)
+    {
+        if (_leaf_active[leaf]) return;
+        _leaf_active[leaf] = true;
+        _reuse_cost += LeafCost(leaf, &_leaf_site_count[leaf * SLOT_NUM], _decision[_index->_leaf_head[leaf]]);
+    }
+
+    /// the change of total cost if bblid is assigned to site
+    COST Delta(BBLID bblid, CostSite site) const
+    {
+        CostSite oldsite = _decision[bblid];
+        if (oldsite == site) return 0;
+
+        COST delta = 0;
+        if (oldsite == CPU || oldsite == PIM)
+            delta -= _index->_elapsed[oldsite][bblid];
+        if (site == CPU || site == PIM)
+            delta += _index->_elapsed[site][bblid];
+
+        for (uint32_t i = _index->_bbl_leaf_begin[bblid]; i < _index->_bbl_leaf_begin[bblid + 1]; ++i) {
+            uint32_t leaf = _index->_bbl_leaf[i];
+            if (!_leaf_active[leaf]) continue;
+            BBLID head = _index->_leaf_head[leaf];
+            const uint32_t *count = &_leaf_site_count[leaf * SLOT_NUM];
+            uint32_t newcount[SLOT_NUM] = { count[0], count[1], count[2] };
+            newcount[Slot(oldsite)]--;
+            newcount[Slot(site)]++;
+            delta += LeafCost(leaf, newcount, SiteAfter(head, bblid, site))
+                - LeafCost(leaf, count, _decision[head]);
+        }
+
+        for (uint32_t i = _index->_bbl_edge_begin[bblid]; i < _index->_bbl_edge_begin[bblid + 1]; ++i) {
+            uint32_t e = _index->_bbl_edge[i];
+            BBLID from = _index->_edge_from[e];
+            BBLID to = _index->_edge_to[e];
+            delta += EdgeCost(e, SiteAfter(from, bblid, site), SiteAfter(to, bblid, site))
+                - EdgeCost(e, _decision[from], _decision[to]);
+        }
+        return delta;
+    }
+
+    /// the decrease of total cost if bblid is moved to the other site
+    inline COST FlipGain(BBLID bblid) const
+    {
+        return -Delta(bblid, _decision[bblid] == CPU ? PIM : CPU);
+    }
+
+    void Assign(BBLID bblid, CostSite site)
+    {
+        CostSite oldsite = _decision[bblid];
+        if (oldsite == site) return;
+
+        if (oldsite == CPU || oldsite == PIM)
+            _elapsed_cost[oldsite] -= _index->_elapsed[oldsite][bblid];
+        if (site == CPU || site == PIM)
+            _elapsed_cost[site] += _index->_elapsed[site][bblid];
+
+        for (uint32_t i = _index->_bbl_edge_begin[bblid]; i < _index->_bbl_edge_begin[bblid + 1]; ++i) {
+            uint32_t e = _index->_bbl_edge[i];
+            BBLID from = _index->_edge_from[e];
+            BBLID to = _index->_edge_to[e];
+            _switch_cost += EdgeCost(e, SiteAfter(from, bblid, site), SiteAfter(to, bblid, site))
+                - EdgeCost(e, _decision[from], _decision[to]);
+        }
+
+        for (uint32_t i = _index->_bbl_leaf_begin[bblid]; i < _index->_bbl_leaf_begin[bblid + 1]; ++i) {
+            uint32_t leaf = _index->_bbl_leaf[i];
+            BBLID head = _index->_leaf_head[leaf];
+            uint32_t *count = &_leaf_site_count[leaf * SLOT_NUM];
+            if (!_leaf_active[leaf]) {
+                count[Slot(oldsite)]--;
+                count[Slot(site)]++;
+                continue;
+            }
+            COST oldcost = LeafCost(leaf, count, _decision[head]);
+            count[Slot(oldsite)]--;
+            count[Slot(site)]++;
+            _reuse_cost += LeafCost(leaf, count, SiteAfter(head, bblid, site)) - oldcost;
+        }
+
+        _decision[bblid] = site;
+    }
+
+    inline void Flip(BBLID bblid) { Assign(bblid, _decision[bblid] == CPU ? PIM : CPU); }
+
+    inline const DECISION &decision() const { return _decision; }
+    inline CostSite site(BBLID bblid) const { return _decision[bblid]; }
+    inline COST ElapsedTime(CostSite site) const { return _elapsed_cost[site]; }
+    inline COST ReuseCost() const { return _reuse_cost; }
+    inline COST SwitchCost() const { return _switch_cost; }
+    inline COST Cost() const
+    {
+        return _reuse_cost + _switch_cost + _elapsed_cost[CPU] + _elapsed_cost[PIM];
+    }
+};
+
+} // namespace PIMProf
+
+#endif // __INCREMENTALCOST_H__
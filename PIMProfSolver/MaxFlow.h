@@ -0,0 +1,142 @@
+//===- MaxFlow.h - Max-flow/min-cut on a directed graph ---------*- C++ -*-===//
+//
+//
+//===----------------------------------------------------------------------===//
+//
+//
+//===----------------------------------------------------------------------===//
+#ifndef __MAXFLOW_H__
+#define __MAXFLOW_H__
+
+#include <vector>
+#include <cassert>
+#include <cstdint>
+
+namespace PIMProf
+{
+/* ===================================================================== */
+/* MaxFlowGraph */
+/* ===================================================================== */
+/// A directed graph with capacities of type CapTy, solved with Dinic's algorithm.
+/// Edge e and its reverse residual edge are stored at e and e ^ 1.
+/// The blocking flow is found with an explicit path stack instead of recursion,
+/// since augmenting paths can be as long as the number of nodes.
+template <class CapTy>
+class MaxFlowGraph
+{
+  private:
+    std::vector<uint32_t> _to;
+    std::vector<CapTy> _cap; // residual capacity
+    std::vector<std::vector<uint32_t>> _adj;
+
+    std::vector<int64_t> _level;
+    std::vector<size_t> _arc; // current arc of each node
+
+  public:
+    MaxFlowGraph(uint32_t size = 0) : _adj(size) {}
+
+    inline uint32_t size() const { return _adj.size(); }
+
+    inline uint32_t AddNode()
+    {
+        _adj.emplace_back();
+        return _adj.size() - 1;
+    }
+
+    inline void AddEdge(uint32_t from, uint32_t to, CapTy cap)
+    {
+        assert(from < size() && to < size() && cap >= 0);
+        if (from == to || cap == 0) return;
+        _adj[from].push_back(_to.size());
+        _to.push_back(to);
+        _cap.push_back(cap);
+        _adj[to].push_back(_to.size());
+        _to.push_back(from);
+        _cap.push_back(0);
+    }
+
+    /// returns the value of the maximum flow from source to sink
+    CapTy MaxFlow(uint32_t source, uint32_t sink)
+    {
+        assert(source != sink);
+        CapTy flow = 0;
+        while (BuildLevel(source, sink)) {
+            _arc.assign(size(), 0);
+            flow += BlockingFlow(source, sink);
+        }
+        return flow;
+    }
+
+    /// after MaxFlow, whether node is on the source side of the minimum cut
+    inline bool OnSourceSide(uint32_t node) const { return _level[node] >= 0; }
+
+  private:
+    /// BFS over the residual graph, returns whether sink is reachable.
+    /// When it is not, _level marks the source side of the minimum cut.
+    bool BuildLevel(uint32_t source, uint32_t sink)
+    {
+        _level.assign(size(), -1);
+        std::vector<uint32_t> queue(1, source);
+        _level[source] = 0;
+        for (size_t i = 0; i < queue.size(); ++i) {
+            uint32_t u = queue[i];
+            for (uint32_t e : _adj[u]) {
+                if (_cap[e] > 0 && _level[_to[e]] < 0) {
+                    _level[_to[e]] = _level[u] + 1;
+                    queue.push_back(_to[e]);
+                }
+            }
+        }
+        return _level[sink] >= 0;
+    }
+
+    CapTy BlockingFlow(uint32_t source, uint32_t sink)
+    {
+        CapTy flow = 0;
+        std::vector<uint32_t> path; // edges from source to u
+        uint32_t u = source;
+        while (true) {
+            if (u == sink) {
+                CapTy bottleneck = _cap[path[0]];
+                for (uint32_t e : path) {
+                    if (_cap[e] < bottleneck) bottleneck = _cap[e];
+                }
+                size_t retreat = path.size();
+                for (size_t i = 0; i < path.size(); ++i) {
+                    _cap[path[i]] -= bottleneck;
+                    _cap[path[i] ^ 1] += bottleneck;
+                    if (_cap[path[i]] == 0 && retreat == path.size()) retreat = i;
+                }
+                flow += bottleneck;
+                // continue from the tail of the first saturated edge
+                path.resize(retreat);
+                u = (path.empty() ? source : _to[path.back()]);
+                continue;
+            }
+
+            bool advanced = false;
+            for (size_t &i = _arc[u]; i < _adj[u].size(); ++i) {
+                uint32_t e = _adj[u][i];
+                if (_cap[e] > 0 && _level[_to[e]] == _level[u] + 1) {
+                    path.push_back(e);
+                    u = _to[e];
+                    advanced = true;
+                    break;
+                }
+            }
+            if (advanced) continue;
+
+            // u is a dead end in this level graph
+            if (u == source) break;
+            _level[u] = -1;
+            path.pop_back();
+            u = (path.empty() ? source : _to[path.back()]);
+            _arc[u]++;
+        }
+        return flow;
+    }
+};
+
+} // namespace PIMProf
+
+#endif // __MAXFLOW_H__
@@ -0,0 +1,276 @@
+//===- MultiSite.h - Decisions over more than two sites ---------*- C++ -*-===//
+//
+//
+//===----------------------------------------------------------------------===//
+//
+//
+//===----------------------------------------------------------------------===//
+#ifndef __MULTISITE_H__
+#define __MULTISITE_H__
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cassert>
+
+#include "Common.h"
+#include "IncrementalCost.h"
+#include "MaxFlow.h"
+
+namespace PIMProf
+{
+/// site 0 is CPU, site 1 is PIM, and the other sites follow in command line order
+typedef int SiteID;
+typedef std::vector<SiteID> MULTIDECISION;
+
+/* ===================================================================== */
+/* MultiSiteIndex */
+/* ===================================================================== */
+/// The cost model of CostIndex over _sites sites. Reuse segments and switch edges
+/// are shared with the two site CostIndex, only the costs are per site:
+///     a BBL on site s costs _elapsed[s],
+///     a mixed segment costs count * _mixed_cost[site of its head],
+///     a switch edge from site s to site t != s costs count * switch cost (s, t).
+class MultiSiteIndex
+{
+  public:
+    SiteID _sites = 0;
+    BBLID _size = 0;
+    const CostIndex *_index = nullptr;
+
+    std::vector<std::vector<COST>> _elapsed; // [site][BBLID]
+    std::vector<COST> _mixed_cost;           // [site of head]
+    std::vector<COST> _switch_cost;          // [from * _sites + to]
+
+  public:
+    void initialize(const CostIndex *index, const std::vector<std::vector<COST>> &elapsed,
+        const std::vector<COST> &mixed_cost, const std::vector<COST> &switch_cost)
+    {
+        _index = index;
+        _size = index->_size;
+        _sites = elapsed.size();
+        _elapsed = elapsed;
+        _mixed_cost = mixed_cost;
+        _switch_cost = switch_cost;
+        assert((SiteID)_mixed_cost.size() == _sites);
+        assert((SiteID)_switch_cost.size() == _sites * _sites);
+    }
+
+    inline COST SwitchCost(SiteID from, SiteID to, uint64_t count) const
+    {
+        return (from == to ? 0 : _switch_cost[from * _sites + to] * count);
+    }
+
+    bool Mixed(uint32_t leaf, const MULTIDECISION &decision) const
+    {
+        const CostIndex &index = *_index;
+        SiteID first = decision[index._leaf_member[index._leaf_begin[leaf]]];
+        for (uint32_t m = index._leaf_begin[leaf] + 1; m < index._leaf_begin[leaf + 1]; ++m) {
+            if (decision[index._leaf_member[m]] != first) return true;
+        }
+        return false;
+    }
+
+    /// total cost, with the elapsed time of each site in elapsed if given
+    COST Cost(const MULTIDECISION &decision, std::vector<COST> *elapsed = nullptr,
+        COST *reuse = nullptr, COST *sw = nullptr) const
+    {
+        const CostIndex &index = *_index;
+        std::vector<COST> site_elapsed(_sites, 0);
+        for (BBLID i = 0; i < _size; ++i) {
+            site_elapsed[decision[i]] += _elapsed[decision[i]][i];
+        }
+        COST reuse_cost = 0;
+        for (uint32_t leaf = 0; leaf < index.LeafCount(); ++leaf) {
+            if (Mixed(leaf, decision)) {
+                reuse_cost += index._leaf_count[leaf] * _mixed_cost[decision[index._leaf_head[leaf]]];
+            }
+        }
+        COST switch_cost = 0;
+        for (uint32_t e = 0; e < index.EdgeCount(); ++e) {
+            switch_cost += SwitchCost(decision[index._edge_from[e]], decision[index._edge_to[e]], index._edge_count[e]);
+        }
+
+        COST total = reuse_cost + switch_cost;
+        for (auto elem : site_elapsed) {
+            total += elem;
+        }
+        if (elapsed != nullptr) *elapsed = site_elapsed;
+        if (reuse != nullptr) *reuse = reuse_cost;
+        if (sw != nullptr) *sw = switch_cost;
+        return total;
+    }
+};
+
+/* ===================================================================== */
+/* AlphaExpansion */
+/* ===================================================================== */
+/// Local search over expansion moves: for a site alpha, every BBL either stays
+/// or moves to alpha, and the best such move is one minimum cut, with the BBLs
+/// that move to alpha on the sink side. A move is applied only if it lowers the cost.
+///
+/// Segments are cut exactly as in CostSolver::MinCut, where the two sides are
+/// "stay" and "alpha". A segment whose members do not share one site before the
+/// move stays mixed unless all of them move. A switch term that violates the
+/// triangle inequality through alpha is underestimated for the cut, and the move
+/// is checked against the exact cost.
+class AlphaExpansion
+{
+  public:
+    static const int MAX_SWEEPS = 16;
+
+  private:
+    const MultiSiteIndex *_index;
+    MULTIDECISION _decision;
+    COST _cost;
+    int _moves = 0;
+
+  public:
+    AlphaExpansion(const MultiSiteIndex *index, const MULTIDECISION &start)
+        : _index(index), _decision(start), _cost(index->Cost(start))
+    {}
+
+    /// sweeps over all sites until no move lowers the cost, returns the number of sweeps
+    template <class StopFn>
+    int Run(StopFn stopped)
+    {
+        int sweep = 0;
+        bool improved = true;
+        while (improved && sweep < MAX_SWEEPS) {
+            improved = false;
+            for (SiteID alpha = 0; alpha < _index->_sites && !stopped(); ++alpha) {
+                improved |= Expand(alpha);
+            }
+            sweep++;
+        }
+        return sweep;
+    }
+
+    bool Expand(SiteID alpha)
+    {
+        const MultiSiteIndex &model = *_index;
+        const CostIndex &index = *model._index;
+        BBLID size = model._size;
+        const MULTIDECISION &x = _decision;
+
+        MaxFlowGraph<COST> graph(size + 2);
+        uint32_t source = size, sink = size + 1;
+
+        // an infinite capacity only has to exceed the total of the finite ones
+        COST max_switch = *std::max_element(model._switch_cost.begin(), model._switch_cost.end());
+        COST max_mixed = *std::max_element(model._mixed_cost.begin(), model._mixed_cost.end());
+        COST infinity = 1;
+        for (BBLID i = 0; i < size; ++i) {
+            infinity += model._elapsed[x[i]][i] + model._elapsed[alpha][i];
+        }
+        for (uint32_t e = 0; e < index.EdgeCount(); ++e) {
+            infinity += 3 * max_switch * index._edge_count[e];
+        }
+        for (uint32_t leaf = 0; leaf < index.LeafCount(); ++leaf) {
+            infinity += 2 * max_mixed * index._leaf_count[leaf];
+        }
+
+        // cost c0 if i stays, c1 if i moves to alpha
+        auto unary = [&](BBLID i, COST c0, COST c1) {
+            COST low = std::min(c0, c1);
+            graph.AddEdge(source, i, c1 - low);
+            graph.AddEdge(i, sink, c0 - low);
+        };
+
+        for (BBLID i = 0; i < size; ++i) {
+            if (x[i] != alpha) unary(i, model._elapsed[x[i]][i], model._elapsed[alpha][i]);
+        }
+
+        for (uint32_t e = 0; e < index.EdgeCount(); ++e) {
+            BBLID f = index._edge_from[e], t = index._edge_to[e];
+            uint64_t count = index._edge_count[e];
+            if (f == t || (x[f] == alpha && x[t] == alpha)) continue;
+            if (x[f] == alpha) {
+                unary(t, model.SwitchCost(alpha, x[t], count), 0);
+                continue;
+            }
+            if (x[t] == alpha) {
+                unary(f, model.SwitchCost(x[f], alpha, count), 0);
+                continue;
+            }
+            COST e00 = model.SwitchCost(x[f], x[t], count);
+            COST e01 = model.SwitchCost(x[f], alpha, count);
+            COST e10 = model.SwitchCost(alpha, x[t], count);
+            e00 = std::min(e00, e01 + e10);
+            // e00 + (e10 - e00) y_f + (0 - e10) y_t + (e01 + e10 - e00) (1 - y_f) y_t
+            unary(f, 0, e10 - e00);
+            unary(t, 0, -e10);
+            graph.AddEdge(f, t, e01 + e10 - e00);
+        }
+
+        std::vector<BBLID> members;
+        for (uint32_t leaf = 0; leaf < index.LeafCount(); ++leaf) {
+            if (index.LeafSize(leaf) <= 1) continue;
+            BBLID head = index._leaf_head[leaf];
+            uint64_t count = index._leaf_count[leaf];
+            members.clear();
+            bool uniform = true;
+            for (uint32_t m = index._leaf_begin[leaf]; m < index._leaf_begin[leaf + 1]; ++m) {
+                BBLID member = index._leaf_member[m];
+                if (x[member] == alpha) uniform = false;
+                else members.push_back(member);
+            }
+            if (members.empty()) continue;
+            for (BBLID member : members) {
+                if (x[member] != x[members[0]]) uniform = false;
+            }
+
+            COST stay = count * model._mixed_cost[x[head]];
+            COST move = count * model._mixed_cost[alpha];
+            if (uniform) {
+                // as CostSolver::MinCut, stay is the source side and alpha the sink side
+                uint32_t z = graph.AddNode();
+                uint32_t w = graph.AddNode();
+                graph.AddEdge(head, z, stay);
+                graph.AddEdge(w, head, move);
+                for (BBLID member : members) {
+                    if (member == head) continue;
+                    graph.AddEdge(z, member, infinity);
+                    graph.AddEdge(member, w, infinity);
+                }
+            }
+            else if (x[head] == alpha) {
+                // mixed unless all members move
+                uint32_t w = graph.AddNode();
+                graph.AddEdge(w, sink, move);
+                for (BBLID member : members) {
+                    graph.AddEdge(member, w, infinity);
+                }
+            }
+            else {
+                // mixed if the head stays, or if it moves and any member stays
+                unary(head, stay, 0);
+                uint32_t w = graph.AddNode();
+                graph.AddEdge(w, head, move);
+                for (BBLID member : members) {
+                    if (member != head) graph.AddEdge(member, w, infinity);
+                }
+            }
+        }
+
+        graph.MaxFlow(source, sink);
+        MULTIDECISION next(_decision);
+        for (BBLID i = 0; i < size; ++i) {
+            if (!graph.OnSourceSide(i)) next[i] = alpha;
+        }
+        COST cost = model.Cost(next);
+        if (cost >= _cost) return false;
+        _decision = next;
+        _cost = cost;
+        _moves++;
+        return true;
+    }
+
+    inline const MULTIDECISION &decision() const { return _decision; }
+    inline COST Cost() const { return _cost; }
+    inline int moves() const { return _moves; }
+};
+
+} // namespace PIMProf
+
+#endif // __MULTISITE_H__
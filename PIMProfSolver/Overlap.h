@@ -0,0 +1,98 @@
+//===- Overlap.h - Cost model with concurrent CPU and PIM -------*- C++ -*-===//
+//
+//
+//===----------------------------------------------------------------------===//
+//
+//
+//===----------------------------------------------------------------------===//
+#ifndef __OVERLAP_H__
+#define __OVERLAP_H__
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+#include "Common.h"
+#include "IncrementalCost.h"
+
+namespace PIMProf
+{
+/* ===================================================================== */
+/* OverlapCost */
+/* ===================================================================== */
+/// The cost of a decision when the CPU and PIM parts of a window run concurrently:
+///     sum over windows of max(CPU time, PIM time) + REUSE + SWITCH,
+/// where window[i] is the window of BBL i. With one BBL per window this is
+/// the serialized cost of IncrementalCost, which also keeps REUSE and SWITCH here.
+/// The decision must not contain INVALID.
+class OverlapCost
+{
+  private:
+    const CostIndex *_index = nullptr;
+    const std::vector<uint32_t> *_window = nullptr;
+    IncrementalCost _engine;
+    std::vector<COST> _window_time[MAX_COST_SITE];
+    COST _window_cost = 0;
+
+    inline COST WindowCost(uint32_t w) const
+    {
+        return std::max(_window_time[CPU][w], _window_time[PIM][w]);
+    }
+
+  public:
+    OverlapCost(const CostIndex *index, const std::vector<uint32_t> *window, uint32_t windows, const DECISION &decision)
+        : _index(index), _window(window), _engine(index, decision)
+    {
+        assert((BBLID)window->size() == index->_size);
+        for (int s = 0; s < MAX_COST_SITE; ++s) {
+            _window_time[s].assign(windows, 0);
+        }
+        for (BBLID i = 0; i < index->_size; ++i) {
+            assert(decision[i] == CPU || decision[i] == PIM);
+            _window_time[decision[i]][(*window)[i]] += index->_elapsed[decision[i]][i];
+        }
+        for (uint32_t w = 0; w < windows; ++w) {
+            _window_cost += WindowCost(w);
+        }
+    }
+
+    /// the change of total cost if bblid is assigned to site
+    COST Delta(BBLID bblid, CostSite site) const
+    {
+        CostSite oldsite = _engine.site(bblid);
+        if (oldsite == site) return 0;
+        // the serialized delta, without its elapsed time part
+        COST delta = _engine.Delta(bblid, site)
+            - (_index->_elapsed[site][bblid] - _index->_elapsed[oldsite][bblid]);
+
+        uint32_t w = (*_window)[bblid];
+        COST time[MAX_COST_SITE] = { _window_time[CPU][w], _window_time[PIM][w] };
+        time[oldsite] -= _index->_elapsed[oldsite][bblid];
+        time[site] += _index->_elapsed[site][bblid];
+        return delta + std::max(time[CPU], time[PIM]) - WindowCost(w);
+    }
+
+    void Assign(BBLID bblid, CostSite site)
+    {
+        CostSite oldsite = _engine.site(bblid);
+        if (oldsite == site) return;
+        uint32_t w = (*_window)[bblid];
+        _window_cost -= WindowCost(w);
+        _window_time[oldsite][w] -= _index->_elapsed[oldsite][bblid];
+        _window_time[site][w] += _index->_elapsed[site][bblid];
+        _window_cost += WindowCost(w);
+        _engine.Assign(bblid, site);
+    }
+
+    inline CostSite site(BBLID bblid) const { return _engine.site(bblid); }
+    inline const DECISION &decision() const { return _engine.decision(); }
+    inline COST WindowTime() const { return _window_cost; }
+    inline COST ElapsedTime(CostSite site) const { return _engine.ElapsedTime(site); }
+    inline COST ReuseCost() const { return _engine.ReuseCost(); }
+    inline COST SwitchCost() const { return _engine.SwitchCost(); }
+    inline COST Cost() const { return _window_cost + _engine.ReuseCost() + _engine.SwitchCost(); }
+};
+
+} // namespace PIMProf
+
+#endif // __OVERLAP_H__
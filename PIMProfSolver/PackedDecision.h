@@ -0,0 +1,150 @@
+//===- PackedDecision.h - Bit-packed offloading decision --------*- C++ -*-===//
+//
+//
+//===----------------------------------------------------------------------===//
+//
+//
+//===----------------------------------------------------------------------===//
+#ifndef __PACKEDDECISION_H__
+#define __PACKEDDECISION_H__
+
+#include <vector>
+#include <cassert>
+
+#include "Common.h"
+
+namespace PIMProf
+{
+/* ===================================================================== */
+/* PackedDecision */
+/* ===================================================================== */
+/// A DECISION stored as two bitsets of 64-bit words:
+/// _pim has bit i set if BBL i is on PIM, and
+/// _valid has bit i set if BBL i is assigned, i.e., on CPU or PIM.
+/// A BBL with its _valid bit clear is INVALID, and its _pim bit is always clear.
+class PackedDecision
+{
+  public:
+    std::vector<uint64_t> _pim;
+    std::vector<uint64_t> _valid;
+
+  private:
+    size_t _size = 0;
+
+  public:
+    PackedDecision() {}
+
+    PackedDecision(size_t size, CostSite site = INVALID)
+    {
+        assign(size, site);
+    }
+
+    PackedDecision(const DECISION &decision)
+    {
+        assign(decision);
+    }
+
+    void assign(size_t size, CostSite site)
+    {
+        _size = size;
+        size_t words = (size + 63) / 64;
+        _pim.assign(words, site == PIM ? ~(uint64_t)0 : 0);
+        _valid.assign(words, (site == CPU || site == PIM) ? ~(uint64_t)0 : 0);
+        // keep the bits past the end clear, so that word level counts are exact
+        if (words > 0 && size % 64 != 0) {
+            uint64_t tail = ((uint64_t)1 << (size % 64)) - 1;
+            _pim.back() &= tail;
+            _valid.back() &= tail;
+        }
+    }
+
+    void assign(const DECISION &decision)
+    {
+        _size = decision.size();
+        size_t words = (_size + 63) / 64;
+        _pim.assign(words, 0);
+        _valid.assign(words, 0);
+        for (size_t i = 0; i < _size; ++i) {
+            uint64_t bit = (uint64_t)1 << (i & 63);
+            if (decision[i] == PIM) {
+                _pim[i >> 6] |= bit;
+                _valid[i >> 6] |= bit;
+            }
+            else if (decision[i] == CPU) {
+                _valid[i >> 6] |= bit;
+            }
+        }
+    }
+
+    inline size_t size() const { return _size; }
+    inline size_t words() const { return _pim.size(); }
+
+    inline CostSite get(size_t i) const
+    {
+        assert(i < _size);
+        uint64_t bit = (uint64_t)1 << (i & 63);
+        if (!(_valid[i >> 6] & bit)) return INVALID;
+        return (_pim[i >> 6] & bit) ? PIM : CPU;
+    }
+
+    inline CostSite operator[](size_t i) const { return get(i); }
+
+    inline void set(size_t i, CostSite site)
+    {
+        assert(i < _size);
+        uint64_t bit = (uint64_t)1 << (i & 63);
+        if (site == PIM) {
+            _pim[i >> 6] |= bit;
+            _valid[i >> 6] |= bit;
+        }
+        else if (site == CPU) {
+            _pim[i >> 6] &= ~bit;
+            _valid[i >> 6] |= bit;
+        }
+        else {
+            _pim[i >> 6] &= ~bit;
+            _valid[i >> 6] &= ~bit;
+        }
+    }
+
+    /// the bits of BBLs [64 * w, 64 * w + 64) that are on site
+    inline uint64_t word(size_t w, CostSite site) const
+    {
+        if (site == PIM) return _pim[w];
+        if (site == CPU) return _valid[w] & ~_pim[w];
+        return ~_valid[w];
+    }
+
+    /// number of BBLs on site
+    size_t count(CostSite site) const
+    {
+        size_t result = 0;
+        for (size_t w = 0; w < words(); ++w) {
+            result += __builtin_popcountll(word(w, site));
+        }
+        // INVALID also counts the clear bits past the end
+        if (site != CPU && site != PIM) {
+            result -= words() * 64 - _size;
+        }
+        return result;
+    }
+
+    DECISION unpack() const
+    {
+        DECISION decision(_size);
+        for (size_t i = 0; i < _size; ++i) {
+            decision[i] = get(i);
+        }
+        return decision;
+    }
+
+    inline bool operator==(const PackedDecision &rhs) const
+    {
+        return _size == rhs._size && _pim == rhs._pim && _valid == rhs._valid;
+    }
+    inline bool operator!=(const PackedDecision &rhs) const { return !(*this == rhs); }
+};
+
+} // namespace PIMProf
+
+#endif // __PACKEDDECISION_H__
@@ -0,0 +1,361 @@
+//===- Presolve.h - Reduce the decision problem before search ---*- C++ -*-===//
+//
+//
+//===----------------------------------------------------------------------===//
+//
+//
+//===----------------------------------------------------------------------===//
+#ifndef __PRESOLVE_H__
+#define __PRESOLVE_H__
+
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cassert>
+
+#include "Common.h"
+#include "IncrementalCost.h"
+
+namespace PIMProf
+{
+/* ===================================================================== */
+/* Presolve */
+/* ===================================================================== */
+/// Shrinks a CostIndex to a residual core that has the same optimal decisions.
+///
+/// Fixing: a BBL is fixed to its faster site if its CPU/PIM gap is no less than
+/// the most that its reuse segments and switch edges can save by moving it,
+/// which includes every BBL in no segment or switch edge. The switch edges to
+/// fixed BBLs and the segments that are mixed by fixed BBLs alone become part
+/// of the elapsed time, so fixing is repeated until nothing changes.
+///
+/// Merging: unfixed BBLs that are in exactly the same segments, head none of them,
+/// have no switch edge to an unfixed BBL and prefer the same site are always
+/// on the same site in some optimal decision, so they become one core BBL.
+///
+/// A segment that has fixed members on one site and at least two core members
+/// keeps a pinned core BBL, whose elapsed time on the other site is larger than
+/// anything the segment can save, in place of its fixed members.
+///
+/// The cost of a core decision plus _offset is the cost of its expansion,
+/// as long as every pinned BBL is on its own site.
+class Presolve
+{
+  private:
+    const CostIndex *_index = nullptr;
+    CostIndex _core;
+    COST _offset = 0;
+
+    DECISION _fixed;               // site of each fixed BBL, INVALID if not fixed
+    std::vector<BBLID> _node;      // core BBL of each unfixed BBL
+    std::vector<BBLID> _rep;       // the first BBL of each merged core BBL
+    std::vector<CostSite> _pin;    // site of each pinned core BBL, after the merged ones
+
+    BBLID _isolated = 0;
+    BBLID _fixed_count = 0;
+    BBLID _merged = 0;
+
+    // members of each leaf that are fixed to CPU and PIM
+    std::vector<uint32_t> _leaf_fixed;
+
+    inline static CostSite Other(CostSite site) { return (site == CPU ? PIM : CPU); }
+
+    inline bool AlwaysMixed(uint32_t leaf) const
+    {
+        return _leaf_fixed[leaf * MAX_COST_SITE + CPU] > 0 && _leaf_fixed[leaf * MAX_COST_SITE + PIM] > 0;
+    }
+
+  public:
+    void initialize(const CostIndex *index)
+    {
+        _index = index;
+        _fixed.assign(_index->_size, INVALID);
+        _leaf_fixed.assign(_index->LeafCount() * MAX_COST_SITE, 0);
+        _isolated = _fixed_count = _merged = 0;
+
+        for (BBLID i = 0; i < _index->_size; ++i) {
+            if (Isolated(i)) _isolated++;
+        }
+        Fix();
+        Merge();
+        BuildCore();
+    }
+
+    inline const CostIndex &core() const { return _core; }
+    /// the cost of the fixed BBLs, which the core does not include
+    inline COST offset() const { return _offset; }
+
+    inline BBLID isolated() const { return _isolated; }
+    inline BBLID fixed() const { return _fixed_count; }
+    inline BBLID merged() const { return _merged; }
+    inline BBLID pinned() const { return _pin.size(); }
+
+    /// the decision of the original problem
+    DECISION Expand(const DECISION &core) const
+    {
+        assert((BBLID)core.size() == _core._size);
+        DECISION decision(_index->_size);
+        for (BBLID i = 0; i < _index->_size; ++i) {
+            decision[i] = (_fixed[i] != INVALID ? _fixed[i] : core[_node[i]]);
+        }
+        return decision;
+    }
+
+    /// the core decision closest to decision, merged BBLs follow their first BBL
+    DECISION Restrict(const DECISION &decision) const
+    {
+        assert((BBLID)decision.size() == _index->_size);
+        DECISION core(_core._size);
+        for (BBLID n = 0; n < (BBLID)_rep.size(); ++n) {
+            core[n] = decision[_rep[n]];
+        }
+        for (size_t p = 0; p < _pin.size(); ++p) {
+            core[_rep.size() + p] = _pin[p];
+        }
+        return core;
+    }
+
+  private:
+    bool Isolated(BBLID i) const
+    {
+        const CostIndex &index = *_index;
+        for (uint32_t k = index._bbl_leaf_begin[i]; k < index._bbl_leaf_begin[i + 1]; ++k) {
+            if (index.LeafSize(index._bbl_leaf[k]) > 1) return false;
+        }
+        for (uint32_t k = index._bbl_edge_begin[i]; k < index._bbl_edge_begin[i + 1]; ++k) {
+            uint32_t e = index._bbl_edge[k];
+            if (index._edge_from[e] != index._edge_to[e]) return false;
+        }
+        return true;
+    }
+
+    /// elapsed time of i on each site including the costs that only depend on i,
+    /// returns the most that the other segments and switch edges of i can save by moving it
+    COST Evaluate(BBLID i, COST unary[MAX_COST_SITE]) const
+    {
+        const CostIndex &index = *_index;
+        COST max_mixed = std::max(index._mixed_cost[CPU], index._mixed_cost[PIM]);
+        COST max_switch = std::max(index._switch_cost[CPU], index._switch_cost[PIM]);
+        COST bound = 0;
+        unary[CPU] = index._elapsed[CPU][i];
+        unary[PIM] = index._elapsed[PIM][i];
+
+        for (uint32_t k = index._bbl_edge_begin[i]; k < index._bbl_edge_begin[i + 1]; ++k) {
+            uint32_t e = index._bbl_edge[k];
+            BBLID from = index._edge_from[e], to = index._edge_to[e];
+            if (from == to) continue;
+            CostSite othersite = _fixed[from == i ? to : from];
+            if (othersite == INVALID) {
+                bound += index._edge_count[e] * max_switch;
+                continue;
+            }
+            CostSite site = Other(othersite);
+            unary[site] += index._edge_count[e] * index._switch_cost[from == i ? site : othersite];
+        }
+        for (uint32_t k = index._bbl_leaf_begin[i]; k < index._bbl_leaf_begin[i + 1]; ++k) {
+            uint32_t leaf = index._bbl_leaf[k];
+            if (index.LeafSize(leaf) <= 1) continue;
+            if (!AlwaysMixed(leaf)) {
+                bound += index._leaf_count[leaf] * max_mixed;
+            }
+            else if (index._leaf_head[leaf] == i) {
+                unary[CPU] += index._leaf_count[leaf] * index._mixed_cost[CPU];
+                unary[PIM] += index._leaf_count[leaf] * index._mixed_cost[PIM];
+            }
+        }
+        return bound;
+    }
+
+    inline static CostSite Prefer(const COST unary[MAX_COST_SITE])
+    {
+        return (unary[CPU] <= unary[PIM] ? CPU : PIM);
+    }
+
+    void Fix()
+    {
+        const CostIndex &index = *_index;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (BBLID i = 0; i < index._size; ++i) {
+                if (_fixed[i] != INVALID) continue;
+                COST unary[MAX_COST_SITE];
+                COST bound = Evaluate(i, unary);
+                COST gap = unary[CPU] - unary[PIM];
+                if ((gap < 0 ? -gap : gap) < bound) continue;
+                _fixed[i] = Prefer(unary);
+                _fixed_count++;
+                for (uint32_t k = index._bbl_leaf_begin[i]; k < index._bbl_leaf_begin[i + 1]; ++k) {
+                    _leaf_fixed[index._bbl_leaf[k] * MAX_COST_SITE + _fixed[i]]++;
+                }
+                changed = true;
+            }
+        }
+    }
+
+    void Merge()
+    {
+        const CostIndex &index = *_index;
+        _node.assign(index._size, -1);
+        _rep.clear();
+        std::map<std::pair<std::vector<uint32_t>, CostSite>, BBLID> groups;
+
+        for (BBLID i = 0; i < index._size; ++i) {
+            if (_fixed[i] != INVALID) continue;
+            COST unary[MAX_COST_SITE];
+            Evaluate(i, unary);
+
+            bool mergeable = true;
+            for (uint32_t k = index._bbl_edge_begin[i]; k < index._bbl_edge_begin[i + 1] && mergeable; ++k) {
+                uint32_t e = index._bbl_edge[k];
+                BBLID from = index._edge_from[e], to = index._edge_to[e];
+                if (from != to && _fixed[from == i ? to : from] == INVALID) mergeable = false;
+            }
+            std::vector<uint32_t> leaves;
+            for (uint32_t k = index._bbl_leaf_begin[i]; k < index._bbl_leaf_begin[i + 1] && mergeable; ++k) {
+                uint32_t leaf = index._bbl_leaf[k];
+                if (index.LeafSize(leaf) <= 1 || AlwaysMixed(leaf)) continue;
+                if (index._leaf_head[leaf] == i) mergeable = false;
+                leaves.push_back(leaf);
+            }
+
+            if (mergeable) {
+                auto key = std::make_pair(leaves, Prefer(unary));
+                auto it = groups.find(key);
+                if (it != groups.end()) {
+                    _node[i] = it->second;
+                    _merged++;
+                    continue;
+                }
+                groups[key] = _rep.size();
+            }
+            _node[i] = _rep.size();
+            _rep.push_back(i);
+        }
+    }
+
+    void BuildCore()
+    {
+        const CostIndex &index = *_index;
+        CostIndex &core = _core;
+        COST max_mixed = std::max(index._mixed_cost[CPU], index._mixed_cost[PIM]);
+
+        core._size = _rep.size();
+        for (int s = 0; s < MAX_COST_SITE; ++s) {
+            core._elapsed[s].assign(core._size, 0);
+            core._mixed_cost[s] = index._mixed_cost[s];
+            core._switch_cost[s] = index._switch_cost[s];
+        }
+        core._leaf_head.clear();
+        core._leaf_count.clear();
+        core._leaf_begin.assign(1, 0);
+        core._leaf_member.clear();
+        core._edge_from.clear();
+        core._edge_to.clear();
+        core._edge_count.clear();
+        _pin.clear();
+        _offset = 0;
+
+        for (BBLID i = 0; i < index._size; ++i) {
+            if (_fixed[i] != INVALID) {
+                _offset += index._elapsed[_fixed[i]][i];
+                continue;
+            }
+            core._elapsed[CPU][_node[i]] += index._elapsed[CPU][i];
+            core._elapsed[PIM][_node[i]] += index._elapsed[PIM][i];
+        }
+
+        for (uint32_t e = 0; e < index.EdgeCount(); ++e) {
+            BBLID from = index._edge_from[e], to = index._edge_to[e];
+            if (from == to) continue;
+            CostSite fromsite = _fixed[from], tosite = _fixed[to];
+            uint64_t count = index._edge_count[e];
+            if (fromsite != INVALID && tosite != INVALID) {
+                if (fromsite != tosite) _offset += count * index._switch_cost[fromsite];
+            }
+            else if (fromsite != INVALID) {
+                core._elapsed[Other(fromsite)][_node[to]] += count * index._switch_cost[fromsite];
+            }
+            else if (tosite != INVALID) {
+                core._elapsed[Other(tosite)][_node[from]] += count * index._switch_cost[Other(tosite)];
+            }
+            else if (_node[from] != _node[to]) {
+                core._edge_from.push_back(_node[from]);
+                core._edge_to.push_back(_node[to]);
+                core._edge_count.push_back(count);
+            }
+        }
+
+        // distinct core BBLs of the unfixed members of a leaf
+        std::vector<BBLID> members;
+        std::vector<uint32_t> seen(core._size, -1);
+        for (uint32_t leaf = 0; leaf < index.LeafCount(); ++leaf) {
+            if (index.LeafSize(leaf) <= 1) continue;
+            BBLID head = index._leaf_head[leaf];
+            uint64_t count = index._leaf_count[leaf];
+            if (AlwaysMixed(leaf)) {
+                if (_fixed[head] != INVALID) {
+                    _offset += count * index._mixed_cost[_fixed[head]];
+                }
+                else {
+                    core._elapsed[CPU][_node[head]] += count * index._mixed_cost[CPU];
+                    core._elapsed[PIM][_node[head]] += count * index._mixed_cost[PIM];
+                }
+                continue;
+            }
+
+            members.clear();
+            for (uint32_t m = index._leaf_begin[leaf]; m < index._leaf_begin[leaf + 1]; ++m) {
+                BBLID bblid = index._leaf_member[m];
+                if (_fixed[bblid] != INVALID || seen[_node[bblid]] == leaf) continue;
+                seen[_node[bblid]] = leaf;
+                members.push_back(_node[bblid]);
+            }
+            CostSite site = INVALID; // the site of the fixed members, if any
+            if (_leaf_fixed[leaf * MAX_COST_SITE + CPU] > 0) site = CPU;
+            if (_leaf_fixed[leaf * MAX_COST_SITE + PIM] > 0) site = PIM;
+
+            if (site == INVALID) {
+                // never mixed if every member is merged into one core BBL
+                if (members.size() < 2) continue;
+                core._leaf_head.push_back(_node[head]);
+            }
+            else if (members.empty()) {
+                continue;
+            }
+            else if (members.size() == 1) {
+                // mixed exactly when the only core BBL is not on site
+                CostSite headsite = (_fixed[head] != INVALID ? site : Other(site));
+                core._elapsed[Other(site)][members[0]] += count * index._mixed_cost[headsite];
+                continue;
+            }
+            else {
+                BBLID pin = core._size + _pin.size();
+                _pin.push_back(site);
+                members.push_back(pin);
+                core._leaf_head.push_back(_fixed[head] != INVALID ? pin : _node[head]);
+            }
+            core._leaf_count.push_back(count);
+            core._leaf_member.insert(core._leaf_member.end(), members.begin(), members.end());
+            core._leaf_begin.push_back(core._leaf_member.size());
+        }
+
+        // a pinned BBL off its site costs more than its only segment can save
+        std::vector<uint64_t> pin_count(_pin.size(), 0);
+        for (uint32_t leaf = 0; leaf < core.LeafCount(); ++leaf) {
+            BBLID last = core._leaf_member[core._leaf_begin[leaf + 1] - 1];
+            if (last >= core._size) pin_count[last - core._size] = core._leaf_count[leaf];
+        }
+        core._size += _pin.size();
+        for (size_t p = 0; p < _pin.size(); ++p) {
+            core._elapsed[_pin[p]].push_back(0);
+            core._elapsed[Other(_pin[p])].push_back(pin_count[p] * max_mixed + NsToCost(1));
+        }
+
+        core.BuildReverseIndex();
+    }
+};
+
+} // namespace PIMProf
+
+#endif // __PRESOLVE_H__
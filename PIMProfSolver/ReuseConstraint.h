@@ -0,0 +1,212 @@
+//===- ReuseConstraint.h - Reuse segments compiled to bitsets ---*- C++ -*-===//
+//
+//
+//===----------------------------------------------------------------------===//
+//
+//
+//===----------------------------------------------------------------------===//
+#ifndef __REUSECONSTRAINT_H__
+#define __REUSECONSTRAINT_H__
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "Common.h"
+#include "DataReuse.h"
+#include "PackedDecision.h"
+
+namespace PIMProf
+{
+/* ===================================================================== */
+/* ReuseConstraintTable */
+/* ===================================================================== */
+/// Every leaf of the reuse trie is a constraint (set of BBLs, head, count),
+/// which costs count * (flush + fetch) whenever the set is not all on one site.
+/// The table stores each set either
+///     as a sorted member array, padded to a multiple of SPARSE_ALIGN
+///     by repeating the first member, or
+///     as a bitset window of whole 64-bit words, if the bitset is no larger than the member array.
+///
+/// The decision is evaluated in its packed form, see PackedDecision.
+/// A set is on one site iff all its bits are in _pim, or all in _valid and none in _pim,
+/// or none in _valid. Sparse sets check this with gathers where AVX2/AVX-512 is available.
+class ReuseConstraintTable
+{
+  public:
+    static const int SPARSE_ALIGN = 8;
+
+    // sparse constraints
+    std::vector<BBLID> _sparse_head;
+    std::vector<uint64_t> _sparse_count;
+    std::vector<uint32_t> _sparse_begin;
+    std::vector<uint32_t> _sparse_member;
+
+    // window constraints
+    std::vector<BBLID> _window_head;
+    std::vector<uint64_t> _window_count;
+    std::vector<uint32_t> _window_size;
+    std::vector<uint32_t> _window_base; // index of the first word in the packed decision
+    std::vector<uint32_t> _window_begin;
+    std::vector<uint64_t> _window_mask;
+
+    void initialize(DataReuse<BBLID> &reuse)
+    {
+        _sparse_head.clear();
+        _sparse_count.clear();
+        _sparse_begin.assign(1, 0);
+        _sparse_member.clear();
+        _window_head.clear();
+        _window_count.clear();
+        _window_size.clear();
+        _window_base.clear();
+        _window_begin.assign(1, 0);
+        _window_mask.clear();
+
+        for (auto leaf : reuse.getLeaves()) {
+            DataReuseSegment<BBLID> seg;
+            reuse.ExportSegment(&seg, leaf);
+            seg.insert(seg.getHead());
+            std::vector<uint32_t> member(seg.begin(), seg.end());
+            assert(member.back() < UINT32_MAX);
+
+            uint32_t base = member.front() >> 6;
+            uint32_t words = (member.back() >> 6) - base + 1;
+            if (words * 64 <= member.size() * 32) {
+                _window_head.push_back(seg.getHead());
+                _window_count.push_back(seg.getCount());
+                _window_size.push_back(member.size());
+                _window_base.push_back(base);
+                size_t begin = _window_mask.size();
+                _window_mask.resize(begin + words, 0);
+                for (uint32_t m : member) {
+                    _window_mask[begin + (m >> 6) - base] |= (uint64_t)1 << (m & 63);
+                }
+                _window_begin.push_back(_window_mask.size());
+            }
+            else {
+                _sparse_head.push_back(seg.getHead());
+                _sparse_count.push_back(seg.getCount());
+                // repeating a member does not change whether the set is on one site
+                while (member.size() % SPARSE_ALIGN != 0) {
+                    member.push_back(member.front());
+                }
+                _sparse_member.insert(_sparse_member.end(), member.begin(), member.end());
+                _sparse_begin.push_back(_sparse_member.size());
+            }
+        }
+    }
+
+    inline size_t size() const { return _sparse_head.size() + _window_head.size(); }
+
+    /// the reuse cost of decision, mixed_cost is indexed by the site of the head,
+    /// and a head that is not on CPU is charged as PIM
+    COST Cost(const PackedDecision &decision, const COST mixed_cost[MAX_COST_SITE]) const
+    {
+        return Cost(decision, mixed_cost, 0, size());
+    }
+
+    /// only the constraints [begin, end), the window constraints are numbered before the sparse ones
+    COST Cost(const PackedDecision &decision, const COST mixed_cost[MAX_COST_SITE], size_t begin, size_t end) const
+    {
+        COST cost = 0;
+        size_t windows = _window_head.size();
+        for (size_t i = begin; i < std::min(end, windows); ++i) {
+            if (WindowMixed(decision, i)) {
+                cost += _window_count[i] * mixed_cost[decision.get(_window_head[i]) == CPU ? CPU : PIM];
+            }
+        }
+        for (size_t i = std::max(begin, windows) - windows; i + windows < end; ++i) {
+            if (SparseMixed(decision, i)) {
+                cost += _sparse_count[i] * mixed_cost[decision.get(_sparse_head[i]) == CPU ? CPU : PIM];
+            }
+        }
+        return cost;
+    }
+
+  private:
+    inline bool WindowMixed(const PackedDecision &decision, size_t i) const
+    {
+        uint32_t pimcnt = 0, validcnt = 0;
+        uint32_t base = _window_base[i];
+        for (uint32_t w = _window_begin[i]; w < _window_begin[i + 1]; ++w, ++base) {
+            uint64_t mask = _window_mask[w];
+            pimcnt += __builtin_popcountll(decision._pim[base] & mask);
+            validcnt += __builtin_popcountll(decision._valid[base] & mask);
+        }
+        uint32_t size = _window_size[i];
+        return !(pimcnt == size || (validcnt == size && pimcnt == 0) || validcnt == 0);
+    }
+
+#if defined(__AVX512F__)
+    inline bool SparseMixed(const PackedDecision &decision, size_t i) const
+    {
+        const int *pim = reinterpret_cast<const int *>(decision._pim.data());
+        const int *valid = reinterpret_cast<const int *>(decision._valid.data());
+        const __m512i low = _mm512_set1_epi32(31);
+        const __m512i one = _mm512_set1_epi32(1);
+        __mmask16 allpim = 0xffff, anypim = 0, allvalid = 0xffff, anyvalid = 0;
+        for (uint32_t m = _sparse_begin[i]; m < _sparse_begin[i + 1]; m += 16) {
+            // the member array is padded to a multiple of 8, so the upper half may be masked off
+            __mmask16 lane = (_sparse_begin[i + 1] - m >= 16 ? 0xffff : 0x00ff);
+            __m512i idx = _mm512_maskz_loadu_epi32(lane, &_sparse_member[m]);
+            __m512i word = _mm512_maskz_srli_epi32(lane, idx, 5);
+            __m512i shift = _mm512_and_si512(idx, low);
+            __m512i p = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), lane, word, pim, 4);
+            __m512i v = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), lane, word, valid, 4);
+            __mmask16 pbit = _mm512_test_epi32_mask(_mm512_maskz_srlv_epi32(lane, p, shift), one);
+            __mmask16 vbit = _mm512_test_epi32_mask(_mm512_maskz_srlv_epi32(lane, v, shift), one);
+            allpim &= (pbit | ~lane);
+            anypim |= pbit;
+            allvalid &= (vbit | ~lane);
+            anyvalid |= vbit;
+        }
+        return !(allpim == 0xffff || (allvalid == 0xffff && anypim == 0) || anyvalid == 0);
+    }
+#elif defined(__AVX2__)
+    inline bool SparseMixed(const PackedDecision &decision, size_t i) const
+    {
+        const int *pim = reinterpret_cast<const int *>(decision._pim.data());
+        const int *valid = reinterpret_cast<const int *>(decision._valid.data());
+        const __m256i low = _mm256_set1_epi32(31);
+        int allpim = 0xff, anypim = 0, allvalid = 0xff, anyvalid = 0;
+        for (uint32_t m = _sparse_begin[i]; m < _sparse_begin[i + 1]; m += SPARSE_ALIGN) {
+            __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&_sparse_member[m]));
+            __m256i word = _mm256_srli_epi32(idx, 5);
+            // move the selected bit to the sign bit of each lane
+            __m256i shift = _mm256_sub_epi32(low, _mm256_and_si256(idx, low));
+            __m256i p = _mm256_sllv_epi32(_mm256_i32gather_epi32(pim, word, 4), shift);
+            __m256i v = _mm256_sllv_epi32(_mm256_i32gather_epi32(valid, word, 4), shift);
+            int pbit = _mm256_movemask_ps(_mm256_castsi256_ps(p));
+            int vbit = _mm256_movemask_ps(_mm256_castsi256_ps(v));
+            allpim &= pbit;
+            anypim |= pbit;
+            allvalid &= vbit;
+            anyvalid |= vbit;
+        }
+        return !(allpim == 0xff || (allvalid == 0xff && anypim == 0) || anyvalid == 0);
+    }
+#else
+    inline bool SparseMixed(const PackedDecision &decision, size_t i) const
+    {
+        uint64_t allpim = 1, anypim = 0, allvalid = 1, anyvalid = 0;
+        for (uint32_t m = _sparse_begin[i]; m < _sparse_begin[i + 1]; ++m) {
+            uint32_t elem = _sparse_member[m];
+            uint64_t p = (decision._pim[elem >> 6] >> (elem & 63)) & 1;
+            uint64_t v = (decision._valid[elem >> 6] >> (elem & 63)) & 1;
+            allpim &= p;
+            anypim |= p;
+            allvalid &= v;
+            anyvalid |= v;
+        }
+        return !(allpim || (allvalid && !anypim) || !anyvalid);
+    }
+#endif
+};
+
+} // namespace PIMProf
+
+#endif // __REUSECONSTRAINT_H__
@@ -39,7 +39,7 @@ public:
     // Therefore, the bblid field should be filled after all threads finish execution
     BBLID bblid;
     UUID bblhash;
-    COST elapsed_time; // store the nanosecond count of each basic block
+    COST elapsed_time; // store the elapsed time of each basic block, see NsToCost
     uint64_t instruction_count;
     uint64_t memory_access;
 
@@ -156,9 +156,9 @@ public:
         );
         for(auto it : sorted) {
             total += it.second;
-            std::cout << std::hex << it.first.first << " " << it.first.second << std::dec << " " << it.second << std::endl;
+            std::cout << std::hex << it.first.first << " " << it.first.second << std::dec << " " << CostToNs(it.second) << std::endl;
         }
-        std::cout << "tid = " << tid << ", total = " << total << std::endl;
+        std::cout << "tid = " << tid << ", total = " << CostToNs(total) << std::endl;
 
         std::cout << "switch CPU to PIM = " << m_switch_cpu2pim << std::endl;
         std::cout << "switch PIM to CPU = " << m_switch_pim2cpu << std::endl;
@@ -267,7 +267,7 @@ public:
     void AddTimeInstruction(uint64_t time, uint64_t instr)
     {
         RunStats *bblstats = GetCurrentRunStats();
-        bblstats->elapsed_time += (COST)time / 1e6;
+        bblstats->elapsed_time += FsToCost(time);
         bblstats->instruction_count += instr;
     }
 
@@ -279,7 +279,7 @@ public:
     // time unit is FS (1e-6 NS)
     void AddOffloadingTime(uint64_t time)
     {
-        m_pim_time += (COST)time / 1e6;
+        m_pim_time += FsToCost(time);
     }
 
     void InsertSegOnHit(uintptr_t tag, bool is_store)
@@ -361,7 +361,7 @@ public:
 
     void PrintPIMTime(std::ostream &ofs)
     {
-        ofs << m_pim_time << std::endl;
+        ofs << CostToNs(m_pim_time) << std::endl;
     }
 
     // void PrintDataReuseDotGraph(std::ostream &ofs)
@@ -387,7 +387,7 @@ public:
         {
             UUID bblhash = it->bblhash;
             ofs << std::setw(7) << it->bblid
-                << std::setw(15) << it->elapsed_time
+                << std::setw(15) << CostToNs(it->elapsed_time)
                 << std::setw(15) << it->instruction_count
                 << std::setw(15) << it->memory_access
                 << "  " << std::hex
@@ -419,7 +419,7 @@ public:
     void AddCPUTime(uint64_t time)
     {
         UUID bblhash = GetCurrentBBLHash();
-        m_bblhash2cputime[bblhash] += (COST)time / 1e6;
+        m_bblhash2cputime[bblhash] += FsToCost(time);
     }
 };
 
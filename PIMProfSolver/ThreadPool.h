@@ -0,0 +1,122 @@
+//===- ThreadPool.h - A fixed-size pool of solver workers -------*- C++ -*-===//
+//
+//
+//===----------------------------------------------------------------------===//
+//
+//
+//===----------------------------------------------------------------------===//
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cassert>
+
+namespace PIMProf
+{
+/* ===================================================================== */
+/* ThreadPool */
+/* ===================================================================== */
+/// A pool of size() workers, where worker 0 is the calling thread.
+/// ParallelFor hands out the indexes [0, n) dynamically, so the assignment
+/// of indexes to workers is not deterministic; callers that need a
+/// deterministic result should store per-index results and reduce them afterwards.
+class ThreadPool
+{
+  private:
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _start_cv;
+    std::condition_variable _done_cv;
+
+    // the job that is currently running
+    const std::function<void(int, size_t)> *_body = nullptr;
+    size_t _size = 0;
+    std::atomic<size_t> _next;
+    uint64_t _generation = 0;
+    int _running = 0;
+    bool _stop = false;
+
+    void Work(int worker)
+    {
+        size_t i;
+        while ((i = _next.fetch_add(1)) < _size) {
+            (*_body)(worker, i);
+        }
+    }
+
+    void WorkerLoop(int worker)
+    {
+        uint64_t generation = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _start_cv.wait(lock, [&] { return _stop || _generation != generation; });
+                if (_stop) return;
+                generation = _generation;
+            }
+            Work(worker);
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (--_running == 0) _done_cv.notify_one();
+            }
+        }
+    }
+
+  public:
+    explicit ThreadPool(int threads = 1) : _next(0)
+    {
+        assert(threads >= 1);
+        for (int i = 1; i < threads; ++i) {
+            _threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _start_cv.notify_all();
+        for (auto &t : _threads) {
+            t.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    inline int size() const { return _threads.size() + 1; }
+
+    /// run body(worker, i) for every i in [0, n), worker is in [0, size())
+    void ParallelFor(size_t n, const std::function<void(int, size_t)> &body)
+    {
+        if (n == 0) return;
+        if (_threads.empty() || n == 1) {
+            for (size_t i = 0; i < n; ++i) body(0, i);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _body = &body;
+            _size = n;
+            _next = 0;
+            _running = _threads.size();
+            _generation++;
+        }
+        _start_cv.notify_all();
+        Work(0);
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done_cv.wait(lock, [&] { return _running == 0; });
+        _body = nullptr;
+    }
+};
+
+} // namespace PIMProf
+
+#endif // __THREADPOOL_H__
@@ -14,10 +14,79 @@ using namespace PIMProf;
 void Usage()
 {
     infomsg("Usage: ./Solver.exe <mode> -c <cpu_stats_file> -p <pim_stats_file> -r <reuse_file> -o <output_file>");
-    infomsg("Select mode from: mpki, para, reuse");
+    infomsg("Select mode from: mpki, para, reuse, debug, mincut, bnb, anneal, component, multilevel, multisite, overlap, capacity, region");
+    infomsg("Options of all modes: -k <trie|constraint> (reuse cost kernel, default trie), -j <thread_count> (default 1)");
+    infomsg("    -w <eager|write-through|lazy|none> (coherence protocol of the reuse cost, default eager)");
+    infomsg("    -B (print the lower bound, an exact solve of the two site model, and the gap to it)");
+    infomsg("    -K <k> (write the k best decisions to <output_file>.top<i>, default 0, not in overlap mode), -d <distance> (minimum BBLs between them, default 1)");
+    infomsg("Options of all modes except mpki/mincut: -t <seconds> (time budget, default 0 for unlimited)");
+    infomsg("    the best decision so far is written to <output_file>.partial, and SIGINT stops the search");
+    infomsg("    -g <epsilon> (stop once the relative gap to the lower bound is at most epsilon, default never)");
+    infomsg("Options of reuse/debug/multilevel mode: -b <batch_size> (default 10, must be less than 64)");
+    infomsg("Options of reuse mode: -f <greedy|hypergraph> (batch former, default greedy)");
+    infomsg("Options of component mode: -b <batch_size> (smaller components are solved exhaustively, default 10),");
+    infomsg("    -s/-T/-e as in anneal mode for the larger components");
+    infomsg("Options of mincut/bnb/anneal/component mode: -P (presolve, search only the reduced core)");
+    infomsg("Options of capacity mode: -C <ns> (PIM core time budget), -M <fraction> (of memory accesses sent to PIM),");
+    infomsg("    -L <threads> (most PIM threads of a BBL on PIM), all unlimited by default");
+    infomsg("Options of region mode: -R <regions> (most contiguous PIM regions in the switch graph, default unlimited)");
+    infomsg("Options of multisite mode: -x <stats_file> (one more offload target, repeatable), -m <cost_config_file>");
+    infomsg("Options of anneal mode: -n <chain_count> (default 8), -s <seed> (default 0), -i <iterations_per_chain> (default 100000),");
+    infomsg("    -T <start_temperature_ns> (default average CPU/PIM gap), -e <end_temperature_ns> (default 1/1000 of start)");
     exit(0);
 }
 
+// options of the modes that only evaluate fixed decisions
+static const char* const eval_short_opt = "c:p:r:o:k:w:j:K:d:BPh";
+static const option eval_long_opt[] = {
+    {"cpu", required_argument, nullptr, 'c'},
+    {"pim", required_argument, nullptr, 'p'},
+    {"reuse", required_argument, nullptr, 'r'},
+    {"output", required_argument, nullptr, 'o'},
+    {"reuse-kernel", required_argument, nullptr, 'k'},
+    {"coherence", required_argument, nullptr, 'w'},
+    {"threads", required_argument, nullptr, 'j'},
+    {"top-k", required_argument, nullptr, 'K'},
+    {"min-distance", required_argument, nullptr, 'd'},
+    {"bound", no_argument, nullptr, 'B'},
+    {"presolve", no_argument, nullptr, 'P'},
+    {"help", no_argument, nullptr, 'h'},
+    {nullptr, no_argument, nullptr, 0}
+};
+
+// options of the modes that search for decisions
+static const char* const search_short_opt = "c:p:x:m:r:o:k:w:b:f:j:K:d:t:g:n:s:i:T:e:C:M:L:R:BPh";
+static const option search_long_opt[] = {
+    {"cpu", required_argument, nullptr, 'c'},
+    {"pim", required_argument, nullptr, 'p'},
+    {"reuse", required_argument, nullptr, 'r'},
+    {"output", required_argument, nullptr, 'o'},
+    {"extra-stats", required_argument, nullptr, 'x'},
+    {"cost-config", required_argument, nullptr, 'm'},
+    {"reuse-kernel", required_argument, nullptr, 'k'},
+    {"coherence", required_argument, nullptr, 'w'},
+    {"batch-size", required_argument, nullptr, 'b'},
+    {"batch-former", required_argument, nullptr, 'f'},
+    {"threads", required_argument, nullptr, 'j'},
+    {"top-k", required_argument, nullptr, 'K'},
+    {"min-distance", required_argument, nullptr, 'd'},
+    {"time-budget", required_argument, nullptr, 't'},
+    {"gap", required_argument, nullptr, 'g'},
+    {"chains", required_argument, nullptr, 'n'},
+    {"seed", required_argument, nullptr, 's'},
+    {"iterations", required_argument, nullptr, 'i'},
+    {"start-temperature", required_argument, nullptr, 'T'},
+    {"end-temperature", required_argument, nullptr, 'e'},
+    {"pim-core-time", required_argument, nullptr, 'C'},
+    {"pim-memory-fraction", required_argument, nullptr, 'M'},
+    {"pim-parallelism", required_argument, nullptr, 'L'},
+    {"max-regions", required_argument, nullptr, 'R'},
+    {"bound", no_argument, nullptr, 'B'},
+    {"presolve", no_argument, nullptr, 'P'},
+    {"help", no_argument, nullptr, 'h'},
+    {nullptr, no_argument, nullptr, 0}
+};
+
 void CommandLineParser::initialize(int argc, char *argv[])
 {
     auto parser = [&](const char* const short_opt, const option long_opt[]) {
@@ -31,10 +100,65 @@ void CommandLineParser::initialize(int argc, char *argv[])
                 _cpustatsfile = std::string(optarg); std::cout << "c " << _cpustatsfile << std::endl; break;
             case 'p':
                 _pimstatsfile = std::string(optarg); std::cout << "p " << _pimstatsfile << std::endl; break;
+            case 'x':
+                _extrastatsfiles.push_back(std::string(optarg)); std::cout << "x " << optarg << std::endl; break;
+            case 'm':
+                _costconfigfile = std::string(optarg); std::cout << "m " << _costconfigfile << std::endl; break;
             case 'r':
                 _reusefile = std::string(optarg); std::cout << "r " << _reusefile << std::endl; break;
             case 'o':
                 _outputfile = std::string(optarg); std::cout << "o " << _outputfile << std::endl; break;
+            case 'k':
+                if (std::string(optarg) == "trie") _reuse_kernel = ReuseKernel::TRIE;
+                else if (std::string(optarg) == "constraint") _reuse_kernel = ReuseKernel::CONSTRAINT;
+                else Usage();
+                std::cout << "k " << optarg << std::endl; break;
+            case 'w':
+                if (std::string(optarg) == "eager") _coherence = Coherence::EAGER;
+                else if (std::string(optarg) == "write-through") _coherence = Coherence::WRITE_THROUGH;
+                else if (std::string(optarg) == "lazy") _coherence = Coherence::LAZY;
+                else if (std::string(optarg) == "none") _coherence = Coherence::NONE;
+                else Usage();
+                std::cout << "w " << optarg << std::endl; break;
+            case 'b':
+                _batch_size = std::stoi(optarg); std::cout << "b " << _batch_size << std::endl; break;
+            case 'f':
+                if (std::string(optarg) == "greedy") _batch_former = BatchFormer::GREEDY;
+                else if (std::string(optarg) == "hypergraph") _batch_former = BatchFormer::HYPERGRAPH;
+                else Usage();
+                std::cout << "f " << optarg << std::endl; break;
+            case 'j':
+                _threads = std::stoi(optarg); std::cout << "j " << _threads << std::endl; break;
+            case 'K':
+                _top_k = std::stoul(optarg); std::cout << "K " << _top_k << std::endl; break;
+            case 'd':
+                _min_distance = std::stoi(optarg); std::cout << "d " << _min_distance << std::endl; break;
+            case 't':
+                _time_budget = std::stod(optarg); std::cout << "t " << _time_budget << std::endl; break;
+            case 'g':
+                _gap = std::stod(optarg); std::cout << "g " << _gap << std::endl; break;
+            case 'n':
+                _chains = std::stoi(optarg); std::cout << "n " << _chains << std::endl; break;
+            case 's':
+                _seed = std::stoull(optarg); std::cout << "s " << _seed << std::endl; break;
+            case 'i':
+                _iterations = std::stoull(optarg); std::cout << "i " << _iterations << std::endl; break;
+            case 'T':
+                _start_temperature = std::stod(optarg); std::cout << "T " << _start_temperature << std::endl; break;
+            case 'e':
+                _end_temperature = std::stod(optarg); std::cout << "e " << _end_temperature << std::endl; break;
+            case 'C':
+                _pim_core_time = std::stod(optarg); std::cout << "C " << _pim_core_time << std::endl; break;
+            case 'M':
+                _pim_memory_fraction = std::stod(optarg); std::cout << "M " << _pim_memory_fraction << std::endl; break;
+            case 'L':
+                _pim_parallelism = std::stoi(optarg); std::cout << "L " << _pim_parallelism << std::endl; break;
+            case 'R':
+                _max_regions = std::stoi(optarg); std::cout << "R " << _max_regions << std::endl; break;
+            case 'B':
+                _bound = true; std::cout << "B" << std::endl; break;
+            case 'P':
+                _presolve = true; std::cout << "P" << std::endl; break;
             case 'h': // -h or --help
             case '?': // Unrecognized option
             default:
@@ -49,17 +173,15 @@ void CommandLineParser::initialize(int argc, char *argv[])
     optind++;
     if (_mode_string == "mpki") {
         _mode = Mode::MPKI;
-        const char* const short_opt = "c:p:r:o:h";
-        const option long_opt[] = {
-            {"cpu", required_argument, nullptr, 'c'},
-            {"pim", required_argument, nullptr, 'p'},
-            {"reuse", required_argument, nullptr, 'r'},
-            {"output", required_argument, nullptr, 'o'},
-            {"help", no_argument, nullptr, 'h'},
-            {nullptr, no_argument, nullptr, 0}
-        };
-        parser(short_opt, long_opt);
-        if (_cpustatsfile == "" || _pimstatsfile == "" || _outputfile == "") {
+        parser(eval_short_opt, eval_long_opt);
+        if (_cpustatsfile == "" || _pimstatsfile == "" || _outputfile == "" || _threads <= 0 || _min_distance <= 0) {
+            Usage();
+        }
+    }
+    else if (_mode_string == "mincut") {
+        _mode = Mode::MINCUT;
+        parser(eval_short_opt, eval_long_opt);
+        if (_cpustatsfile == "" || _pimstatsfile == "" || _reusefile == "" || _outputfile == "" || _threads <= 0 || _min_distance <= 0) {
             Usage();
         }
     }
@@ -67,35 +189,21 @@ void CommandLineParser::initialize(int argc, char *argv[])
         _mode = Mode::PARA;
         assert(0);
     }
-    else if (_mode_string == "reuse") {
-        _mode = Mode::REUSE;
-        const char* const short_opt = "c:p:r:o:h";
-        const option long_opt[] = {
-            {"cpu", required_argument, nullptr, 'c'},
-            {"pim", required_argument, nullptr, 'p'},
-            {"reuse", required_argument, nullptr, 'r'},
-            {"output", required_argument, nullptr, 'o'},
-            {"help", no_argument, nullptr, 'h'},
-            {nullptr, no_argument, nullptr, 0}
-        };
-        parser(short_opt, long_opt);
-        if (_cpustatsfile == "" || _pimstatsfile == "" || _reusefile == "" || _outputfile == "") {
-            Usage();
-        }
-    }
-    else if (_mode_string == "debug") {
-        _mode = Mode::DEBUG;
-        const char* const short_opt = "c:p:r:o:h";
-        const option long_opt[] = {
-            {"cpu", required_argument, nullptr, 'c'},
-            {"pim", required_argument, nullptr, 'p'},
-            {"reuse", required_argument, nullptr, 'r'},
-            {"output", required_argument, nullptr, 'o'},
-            {"help", no_argument, nullptr, 'h'},
-            {nullptr, no_argument, nullptr, 0}
-        };
-        parser(short_opt, long_opt);
-        if (_cpustatsfile == "" || _pimstatsfile == "" || _reusefile == "" || _outputfile == "") {
+    else if (_mode_string == "reuse" || _mode_string == "debug" || _mode_string == "bnb" || _mode_string == "anneal" || _mode_string == "component"
+        || _mode_string == "multilevel" || _mode_string == "multisite" || _mode_string == "overlap" || _mode_string == "capacity"
+        || _mode_string == "region") {
+        if (_mode_string == "reuse") _mode = Mode::REUSE;
+        if (_mode_string == "debug") _mode = Mode::DEBUG;
+        if (_mode_string == "bnb") _mode = Mode::BNB;
+        if (_mode_string == "anneal") _mode = Mode::ANNEAL;
+        if (_mode_string == "component") _mode = Mode::COMPONENT;
+        if (_mode_string == "multilevel") _mode = Mode::MULTILEVEL;
+        if (_mode_string == "multisite") _mode = Mode::MULTISITE;
+        if (_mode_string == "overlap") _mode = Mode::OVERLAP;
+        if (_mode_string == "capacity") _mode = Mode::CAPACITY;
+        if (_mode_string == "region") _mode = Mode::REGION;
+        parser(search_short_opt, search_long_opt);
+        if (_cpustatsfile == "" || _pimstatsfile == "" || _reusefile == "" || _outputfile == "" || _batch_size <= 0 || _batch_size >= 64 || _threads <= 0 || _min_distance <= 0 || _time_budget < 0 || _chains <= 0 || _start_temperature < 0 || _end_temperature < 0) {
             Usage();
         }
     }
@@ -9,6 +9,7 @@
 #define __PINUTIL_H__
 
 #include <stack>
+#include <vector>
 #include <algorithm>
 #include <iostream>
 #include <bitset>
@@ -23,28 +24,43 @@ namespace PIMProf {
 /* ===================================================================== */
 /* DisjointSet */
 /* ===================================================================== */
+/// Dense union-find over BBLIDs 0 ... size - 1, with union by rank and path halving.
 class DisjointSet {
   public:
-    std::unordered_map<BBLID, BBLID> parent;
+    std::vector<BBLID> parent;
+    std::vector<uint8_t> rank;
 
-    BBLID Find(BBLID l) {
-        auto it = parent.find(l);
-        if (it == parent.end()) {
-            parent[l] = l;
+    DisjointSet(BBLID size = 0) { resize(size); }
+
+    void resize(BBLID size) {
+        BBLID oldsize = parent.size();
+        parent.resize(size);
+        rank.resize(size, 0);
+        for (BBLID i = oldsize; i < size; ++i) {
+            parent[i] = i;
         }
-        else {
-            while (parent[l] != l) {
-                parent[l] = parent[parent[l]];
-                l = parent[l];
-            }
+    }
+
+    inline BBLID size() const { return parent.size(); }
+
+    BBLID Find(BBLID l) {
+        assert(l >= 0 && l < size());
+        while (parent[l] != l) {
+            parent[l] = parent[parent[l]];
+            l = parent[l];
         }
         return l;
     }
 
-    void Union(BBLID m, BBLID n) {
+    /// returns the root of the merged set
+    BBLID Union(BBLID m, BBLID n) {
         BBLID x = Find(m);
         BBLID y = Find(n);
+        if (x == y) return x;
+        if (rank[x] > rank[y]) std::swap(x, y);
         parent[x] = y;
+        if (rank[x] == rank[y]) rank[y]++;
+        return y;
     }
 };
 
@@ -104,22 +120,76 @@ PRETTY_PRINT_FUNC_HELPER(warning, YELLOWCOLOR)
 class CommandLineParser {
   public:
     enum Mode {
-        MPKI, PARA, REUSE, DEBUG
+        MPKI, PARA, REUSE, DEBUG, MINCUT, BNB, ANNEAL, COMPONENT, MULTILEVEL, MULTISITE, OVERLAP, CAPACITY, REGION
+    };
+    enum class ReuseKernel {
+        TRIE, CONSTRAINT
+    };
+    enum class BatchFormer {
+        GREEDY, HYPERGRAPH
+    };
+    /// how the reuse cost of a mixed segment is charged, see CostSolver::MixedCost
+    enum class Coherence {
+        EAGER, WRITE_THROUGH, LAZY, NONE
     };
   private:
     std::string _cpustatsfile, _pimstatsfile;
+    std::vector<std::string> _extrastatsfiles; // stats of the sites after CPU and PIM
+    std::string _costconfigfile; // switch and flush/fetch costs of every site
     std::string _reusefile;
     std::string _outputfile;
     Mode _mode;
+    int _batch_size = 10;
+    int _threads = 1;
+    double _time_budget = 0; // in seconds, 0 for unlimited
+    int _chains = 8;
+    uint64_t _seed = 0;
+    uint64_t _iterations = 100000;
+    double _start_temperature = 0; // in nanoseconds, 0 for automatic
+    double _end_temperature = 0; // in nanoseconds, 0 for 1/1000 of the start temperature
+    ReuseKernel _reuse_kernel = ReuseKernel::TRIE;
+    BatchFormer _batch_former = BatchFormer::GREEDY;
+    Coherence _coherence = Coherence::EAGER;
+    bool _presolve = false;
+    size_t _top_k = 0; // the number of decisions written to <output>.top<i>, 0 for none
+    int _min_distance = 1; // between those decisions, in BBLs
+    double _gap = -1; // relative gap to the lower bound at which the search stops, negative for never
+    bool _bound = false; // compute and print the lower bound
+    double _pim_core_time = -1; // budget of the PIM core time in nanoseconds, negative for unlimited
+    double _pim_memory_fraction = -1; // of all memory accesses that may go to PIM, negative for unlimited
+    int _pim_parallelism = -1; // the most PIM threads a BBL on PIM may use, negative for unlimited
+    int _max_regions = -1; // the most contiguous PIM regions, negative for unlimited
 
   public:
     void initialize(int argc, char *argv[]);
 
     inline std::string cpustatsfile() { return _cpustatsfile; }
     inline std::string pimstatsfile() { return _pimstatsfile; }
+    inline const std::vector<std::string> &extrastatsfiles() { return _extrastatsfiles; }
+    inline std::string costconfigfile() { return _costconfigfile; }
     inline std::string reusefile() { return _reusefile; }
     inline std::string outputfile() { return _outputfile; }
     inline Mode mode() { return _mode; }
+    inline int batchsize() { return _batch_size; }
+    inline int threads() { return _threads; }
+    inline double timebudget() { return _time_budget; }
+    inline int chains() { return _chains; }
+    inline uint64_t seed() { return _seed; }
+    inline uint64_t iterations() { return _iterations; }
+    inline double starttemperature() { return _start_temperature; }
+    inline double endtemperature() { return _end_temperature; }
+    inline ReuseKernel reusekernel() { return _reuse_kernel; }
+    inline BatchFormer batchformer() { return _batch_former; }
+    inline Coherence coherence() { return _coherence; }
+    inline bool presolve() { return _presolve; }
+    inline double gap() { return _gap; }
+    inline bool bound() { return _bound; }
+    inline size_t topk() { return _top_k; }
+    inline int mindistance() { return _min_distance; }
+    inline double pimcoretime() { return _pim_core_time; }
+    inline double pimmemoryfraction() { return _pim_memory_fraction; }
+    inline int pimparallelism() { return _pim_parallelism; }
+    inline int maxregions() { return _max_regions; }
     inline bool enableglobalbbl() { return true; } // whether considering the dependency with the global BBL, for debug use
 
 };